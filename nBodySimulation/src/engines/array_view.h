@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Read-only view of a contiguous array owned by someone else, used to hand out the
+ * engine's body arrays without copying them.
+ *
+ * A view does not keep the array alive. Engine views stay valid until the engine's
+ * version changes (see PhysicsEngine::GetVersion).
+ */
+template <typename T>
+class ArrayView {
+public:
+	ArrayView() : data_(nullptr), size_(0) { }
+	ArrayView(const T *data, size_t size) : data_(data), size_(size) { }
+
+	const T &operator[](size_t idx) const { return data_[idx]; }
+	const T *data() const { return data_; }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	const T *begin() const { return data_; }
+	const T *end() const { return data_ + size_; }
+
+	// View of count elements starting at first, clamped to the end of this view
+	ArrayView Slice(size_t first, size_t count) const {
+		first = first < size_ ? first : size_;
+		count = count < size_ - first ? count : size_ - first;
+		return ArrayView(data_ + first, count);
+	}
+
+private:
+	const T *data_;
+	size_t size_;
+};
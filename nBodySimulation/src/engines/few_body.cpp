@@ -1,6 +1,9 @@
 #include "few_body.h"
+#include "parallel.h"
+#include "..\io\event_log.h"
 
 #include "ofVec3f.h"
+#include <algorithm>
 #include <cmath>
 
 /**
@@ -15,20 +18,24 @@ FewBodyEngine::FewBodyEngine(double interval, bool elastic)
  * Main loop, updates the positions of all the bodies based on the step amount.
  */
 void FewBodyEngine::update() {
-	time_ += time_interval_;
-	
-	// Calculate the forces acting on all the bodies and update the velocity
-	for (Body &m : bodies_) {
-		ofVec3f force = CalculateForce(m);
-		m.velocity = CalculateVelocity(m, force);
+	// One pass over all pairs finds both the forces and the overlapping bodies
+	SweepPairs();
+
+	// The contacts were found at the current positions, so resolve them before moving
+	HandleCollisions();
+
+	// Update the velocities using the forces from the sweep
+	for (int i = 0; i < body_count_; i++) {
+		velocities_[i] = CalculateVelocity(i, forces_[i]);
 	}
 
 	// Finally, update all positions based on the new velocities
-	for (Body &m : bodies_) {
-		m.position = CalculatePosition(m);
+	for (int i = 0; i < body_count_; i++) {
+		positions_[i] = CalculatePosition(i);
 	}
 
-	HandleCollisions();
+	time_ += time_interval_;
+	version_++;
 }
 
 /**
@@ -40,19 +47,49 @@ void FewBodyEngine::SetElasticCollisions(bool elastic) {
 	elastic_collisions_ = elastic;
 }
 
+/**
+ * Computes the net force on every body and collects the overlapping pairs in the same
+ * pass, so the squared distance of each pair is only calculated once per step. The
+ * bodies are split across threads and each thread records contacts in its own list.
+ */
+void FewBodyEngine::SweepPairs() {
+	forces_.resize(body_count_);
+
+	thread_contacts_.resize(CountWorkerThreads());
+	for (vector<Contact> &contacts : thread_contacts_) {
+		contacts.clear();
+	}
+
+	ParallelFor(body_count_, kMinSweepChunk, [this](int thread_idx, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			forces_[i] = CalculateForce(i, thread_contacts_[thread_idx]);
+		}
+	});
+}
+
 /**
  * Calculates the net gravitational force on a particular body exerted
  * by all other bodies in the simulation at a particular time instant.
+ * Any body found to overlap it with a larger index is added to the contacts.
  *
- * @param body the body whose net force is to be calculated
+ * @param body_idx the index of the body whose net force is to be calculated
+ * @param contacts the list that overlapping pairs are appended to
  * @return the net force on the body
  */
-ofVec3f FewBodyEngine::CalculateForce(const Body &body) const {
+ofVec3f FewBodyEngine::CalculateForce(int body_idx, vector<Contact> &contacts) const {
+	const ofVec3f &position = positions_[body_idx];
 	ofVec3f net_force(0, 0, 0);
 
 	// Loop through each body and sum up the forces
-	for (const Body &m : bodies_) {
-		net_force = net_force + CalculateGravity(m, body);
+	for (int j = 0; j < body_count_; j++) {
+		double dist_sq = positions_[j].squareDistance(position);
+		net_force = net_force + CalculateGravity(j, body_idx, dist_sq);
+
+		// Each pair is only recorded once, by its lower index
+		double sum_radii = radii_[body_idx] + radii_[j];
+		if (j > body_idx && dist_sq <= sum_radii * sum_radii) {
+			contacts.push_back({ CalculateContactTime(body_idx, j, dist_sq), body_idx, j });
+		}
 	}
 
 	return net_force;
@@ -63,60 +100,101 @@ ofVec3f FewBodyEngine::CalculateForce(const Body &body) const {
  * Calculates the gravitational force exerted by m1 on m2 using 
  * Newton's law of Universal Gravitation.
  *
- * @param m1 the first body
- * @param m2 the second body
+ * @param body1_idx the index of the first body, m1
+ * @param body2_idx the index of the second body, m2
+ * @param dist_sq the squared distance between the bodies
  *
  * @return gravitational force vector
  */
-ofVec3f FewBodyEngine::CalculateGravity(const Body &m1, const Body &m2) const {
+ofVec3f FewBodyEngine::CalculateGravity(int body1_idx, int body2_idx, double dist_sq) const {
 	// Optimization; a body cannot exert a force on itself
-	if (m1.position == m2.position) {
+	if (positions_[body1_idx] == positions_[body2_idx]) {
 		return ofVec3f(0, 0, 0);
 	}
 
-	double dist_sq = m1.position.squareDistance(m2.position);
-
 	// Get the magnitude of the gravitational force by -GmM/r^2
-	double magnitude = (kG*1000000000000 * m1.mass * m2.mass / dist_sq);
+	double magnitude = (kG*1000000000000 * masses_[body1_idx] * masses_[body2_idx] / dist_sq);
 
 	// Convert this to a vector by scaling the vector from body 1 to 2 by the magnitude
-	return (m1.position - m2.position).scale(magnitude);
+	return (positions_[body1_idx] - positions_[body2_idx]).scale(magnitude);
 }
 
 /**
  * Calculates the new velocity of a body given a force.
  *
- * @param body the body being considered
+ * @param body_idx the index of the body being considered
  * @param force the force acting on the body
  * @return the new velocity of the body
  */
-ofVec3f FewBodyEngine::CalculateVelocity(const Body &body, const ofVec3f force) const {
-	ofVec3f acceleration = force / body.mass;
-	return body.velocity + (acceleration * time_interval_);
+ofVec3f FewBodyEngine::CalculateVelocity(int body_idx, const ofVec3f force) const {
+	ofVec3f acceleration = force / masses_[body_idx];
+	return velocities_[body_idx] + (acceleration * time_interval_);
 }
 
 /**
 * Calculates the new position of a body using its velocity.
 *
-* @param body the body being considered
+* @param body_idx the index of the body being considered
 * @return the new position of the body
 */
-ofVec3f FewBodyEngine::CalculatePosition(const Body &body) const {
-	return body.position + body.velocity * (float)time_interval_;
+ofVec3f FewBodyEngine::CalculatePosition(int body_idx) const {
+	return positions_[body_idx] + velocities_[body_idx] * (float)time_interval_;
 }
 
 /**
- * Handles collisions of the bodies elastically or inelastically.
+ * Handles collisions of the bodies elastically or inelastically, using the contacts
+ * found during the latest sweep.
+ *
+ * The contacts from every thread are sorted by the time they happened and then by
+ * index, and resolved one at a time in that order. This makes the result independent
+ * of how the sweep was split across threads. Bodies absorbed by a merge are only
+ * removed once every contact has been resolved, so the indices stay valid throughout.
  */
 void FewBodyEngine::HandleCollisions() {
+	contacts_.clear();
+	for (const vector<Contact> &contacts : thread_contacts_) {
+		contacts_.insert(contacts_.end(), contacts.begin(), contacts.end());
+	}
+
+	if (contacts_.empty()) {
+		return;
+	}
+
+	std::sort(contacts_.begin(), contacts_.end());
+
+	survivors_.resize(body_count_);
 	for (int i = 0; i < body_count_; i++) {
-		for (int j = 0; j < body_count_; j++) {
-			if (Intersect(i, j)	&& i != j) {
-				Collide(i, j);
-				return;
-			}
+		survivors_[i] = i;
+	}
+
+	for (const Contact &contact : contacts_) {
+		// A body that has been merged collides as part of the body that absorbed it
+		int body1_idx = FindSurvivor(contact.body1_idx);
+		int body2_idx = FindSurvivor(contact.body2_idx);
+		if (body1_idx == body2_idx) {
+			continue;
 		}
+
+		// An earlier merge may have moved or grown either body, so check them again
+		if (Intersect(body1_idx, body2_idx)) {
+			Collide(std::min(body1_idx, body2_idx), std::max(body1_idx, body2_idx));
+		}
+	}
+
+	RemoveMergedBodies();
+}
+
+/**
+ * Orders contacts by the time they happened, breaking ties by the body indices.
+ */
+bool FewBodyEngine::Contact::operator<(const Contact &other) const {
+	if (time != other.time) {
+		return time < other.time;
+	}
+	if (body1_idx != other.body1_idx) {
+		return body1_idx < other.body1_idx;
 	}
+	return body2_idx < other.body2_idx;
 }
 
 /**
@@ -127,18 +205,94 @@ void FewBodyEngine::HandleCollisions() {
  * @param body2_idx the index of the second body in the bodies list
  * @return true if the bodies are in contact
  */
-bool FewBodyEngine::Intersect(int body1_idx, int body2_idx) {
-	double distance = bodies_[body1_idx].position.squareDistance(bodies_[body2_idx].position);
-	double sum_radii = std::pow(CalculateRadius(bodies_[body1_idx].mass) 
-							  + CalculateRadius(bodies_[body2_idx].mass), 2);
-	
-	return distance <= sum_radii;
+bool FewBodyEngine::Intersect(int body1_idx, int body2_idx) const {
+	double distance = positions_[body1_idx].squareDistance(positions_[body2_idx]);
+	double sum_radii = radii_[body1_idx] + radii_[body2_idx];
+
+	return distance <= sum_radii * sum_radii;
+}
+
+/**
+ * Estimates when two overlapping bodies first touched by tracing their relative
+ * motion back along their current velocities. The result is limited to the latest
+ * step, so bodies that were already overlapping are treated as touching at its start.
+ *
+ * @param body1_idx the index of the first body in the bodies list
+ * @param body2_idx the index of the second body in the bodies list
+ * @param dist_sq the squared distance between the bodies
+ * @return the simulation time at which the bodies touched
+ */
+double FewBodyEngine::CalculateContactTime(int body1_idx, int body2_idx, double dist_sq) const {
+	ofVec3f rel_position = positions_[body2_idx] - positions_[body1_idx];
+	ofVec3f rel_velocity = velocities_[body2_idx] - velocities_[body1_idx];
+	double sum_radii = radii_[body1_idx] + radii_[body2_idx];
+
+	// Solve |p - v*s|^2 = r^2 for the time s since the bodies touched
+	double a = rel_velocity.lengthSquared();
+	double b = rel_position.dot(rel_velocity);
+	double c = dist_sq - sum_radii * sum_radii;
+
+	double elapsed = time_interval_;
+	if (a > 0) {
+		elapsed = std::min(elapsed, (b + std::sqrt(b * b - a * c)) / a);
+	}
+
+	return time_ - std::max(0.0, elapsed);
+}
+
+/**
+ * Follows the chain of merges from a body to the body that currently contains it.
+ *
+ * @param body_idx the index of the body in the bodies list
+ * @return the index of the body it has been merged into, or body_idx itself
+ */
+int FewBodyEngine::FindSurvivor(int body_idx) const {
+	while (survivors_[body_idx] != body_idx) {
+		body_idx = survivors_[body_idx];
+	}
+
+	return body_idx;
+}
+
+/**
+ * Deletes every body that was absorbed in a merge during the latest collision pass.
+ * The remaining bodies keep their relative order.
+ */
+void FewBodyEngine::RemoveMergedBodies() {
+	RemoveMerged(positions_);
+	RemoveMerged(velocities_);
+	RemoveMerged(masses_);
+	RemoveMerged(colors_);
+	RemoveMerged(ids_);
+	RemoveMerged(radii_);
+	RemoveMerged(forces_);
+
+	body_count_ = (int)ids_.size();
+}
+
+/**
+ * Helper function for RemoveMergedBodies. Removes the entries of merged bodies from
+ * one of the body arrays, keeping the order of the rest.
+ *
+ * @param values the array to compact, indexed like the bodies
+ */
+template <typename T>
+void FewBodyEngine::RemoveMerged(vector<T> &values) const {
+	int kept = 0;
+	for (int i = 0; i < body_count_; i++) {
+		if (survivors_[i] == i) {
+			values[kept++] = values[i];
+		}
+	}
+
+	values.resize(kept);
 }
 
 /**
  * Helper function for collision handling. Calculates the new velocities of the bodies
  * depending on the type of collision. If the collision is inelastic, the function also
- * combines the two bodies, storing the result in the first body and deleting the second.
+ * combines the two bodies, storing the result in the first body and marking the second
+ * to be deleted.
  *
  * Formulas taken from:
  *  - https://en.wikipedia.org/wiki/Elastic_collision
@@ -148,29 +302,44 @@ bool FewBodyEngine::Intersect(int body1_idx, int body2_idx) {
  * @param body2_idx the index of the second body in the bodies list
  */
 void FewBodyEngine::Collide(int body1_idx, int body2_idx) {
-	Body &body1 = bodies_[body1_idx];
-	Body &body2 = bodies_[body2_idx];
+	ofVec3f &position1 = positions_[body1_idx];
+	ofVec3f &position2 = positions_[body2_idx];
+	ofVec3f &velocity1 = velocities_[body1_idx];
+	ofVec3f &velocity2 = velocities_[body2_idx];
+	double &mass1 = masses_[body1_idx];
+	double mass2 = masses_[body2_idx];
+
+	if (event_log_ != nullptr) {
+		event_log_->Record({ time_, ids_[body1_idx], ids_[body2_idx], mass1, mass2,
+							 position1, position2, velocity2 - velocity1, elastic_collisions_ });
+	}
 
 	// Apply the appropriate collision handling strategy
 	if (elastic_collisions_) {
-		ofVec3f v1 = body1.velocity - (2 * body2.mass / (body1.mass + body2.mass)) * (body1.velocity - body2.velocity).dot(body1.position - body2.position) / (body1.position - body2.position).lengthSquared() * (body1.position - body2.position);
-		ofVec3f v2 = body2.velocity - (2 * body1.mass / (body1.mass + body2.mass)) * (body2.velocity - body1.velocity).dot(body2.position - body1.position) / (body2.position - body1.position).lengthSquared() * (body2.position - body1.position);
+		ofVec3f v1 = velocity1 - (2 * mass2 / (mass1 + mass2)) * (velocity1 - velocity2).dot(position1 - position2) / (position1 - position2).lengthSquared() * (position1 - position2);
+		ofVec3f v2 = velocity2 - (2 * mass1 / (mass1 + mass2)) * (velocity2 - velocity1).dot(position2 - position1) / (position2 - position1).lengthSquared() * (position2 - position1);
 
-		body1.velocity = v1;
-		body2.velocity = v2;
+		velocity1 = v1;
+		velocity2 = v2;
 	} else {
 		// If the collision is inelastic, use body1 as the new body and update both its mass and velocity
 		// Formula for inelastic collision take from: 
-		body1.velocity = body1.mass / (body1.mass * body2.mass) * body1.velocity
-					+ body2.mass / (body1.mass * body2.mass) * body2.velocity;
-		body1.mass = body1.mass + body2.mass;
+		velocity1 = mass1 / (mass1 * mass2) * velocity1
+					+ mass2 / (mass1 * mass2) * velocity2;
+		mass1 = mass1 + mass2;
+		radii_[body1_idx] = CalculateRadius(mass1);
 
 		// Take the average of the color and position to make the collision appear more natural
-		body1.color = (body1.color + body2.color) / 2;
-		body1.position = (body1.position + body2.position) / 2;
+		colors_[body1_idx] = (colors_[body1_idx] + colors_[body2_idx]) / 2;
+		position1 = (position1 + position2) / 2;
+
+		// Body 1 also takes on the force that was acting on body 2
+		forces_[body1_idx] += forces_[body2_idx];
 
-		// Delete body 2 as it has been combined with body 1
-		bodies_.erase(bodies_.begin() + body2_idx);
-		body_count_--;
+		// Body 2 has been combined with body 1 and is deleted after all collisions
+		survivors_[body2_idx] = body1_idx;
+		lineage_.RecordMerge(ids_[body1_idx], ids_[body2_idx], time_);
+		changes_.push_back({ BodyChange::MERGED, ids_[body1_idx], ids_[body2_idx],
+							 radii_[body1_idx], colors_[body1_idx] });
 	}
 }
\ No newline at end of file
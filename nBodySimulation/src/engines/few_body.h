@@ -18,15 +18,48 @@ public:
 	void update();
 
 private:
+	// Bodies per thread below which the pair sweep is not worth splitting up
+	static constexpr int kMinSweepChunk = 64;
+
+	/**
+	 * A pair of overlapping bodies found during the force sweep. The first index is
+	 * always the smaller of the two. The time is an estimate of when the bodies first
+	 * touched, used to resolve the contacts in the order they happened.
+	 */
+	struct Contact {
+		double time;
+		int body1_idx;
+		int body2_idx;
+
+		bool operator<(const Contact &other) const;
+	};
+
 	// Position and velocity updating functions
-	ofVec3f CalculateForce(const Body &body) const;
-	ofVec3f CalculateGravity(const Body &body1, const Body &body2) const;
-	ofVec3f CalculateVelocity(const Body &body, const ofVec3f force) const;
-	ofVec3f CalculatePosition(const Body &body) const;
+	void SweepPairs();
+	ofVec3f CalculateForce(int body_idx, vector<Contact> &contacts) const;
+	ofVec3f CalculateGravity(int body1_idx, int body2_idx, double dist_sq) const;
+	ofVec3f CalculateVelocity(int body_idx, const ofVec3f force) const;
+	ofVec3f CalculatePosition(int body_idx) const;
 
 	// Collision handling and detection functions
 	void HandleCollisions();
 	void Collide(int body1_idx, int body2_idx);
-	bool Intersect(int body1_idx, int body2_idx);
-};
+	bool Intersect(int body1_idx, int body2_idx) const;
+	double CalculateContactTime(int body1_idx, int body2_idx, double dist_sq) const;
+	int FindSurvivor(int body_idx) const;
+	void RemoveMergedBodies();
+	template <typename T>
+	void RemoveMerged(vector<T> &values) const;
 
+	// Net force on each body from the latest sweep, parallel to the body arrays
+	vector<ofVec3f> forces_;
+
+	// Contacts found by each thread during the latest sweep
+	vector<vector<Contact>> thread_contacts_;
+
+	// All contacts of the latest sweep, sorted into the order they are resolved in
+	vector<Contact> contacts_;
+
+	// The index of the body each body was merged into, or its own index if it was not
+	vector<int> survivors_;
+};
@@ -0,0 +1,519 @@
+#include "initial_conditions.h"
+#include "parallel.h"
+#include "physics_engine.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Bodies are generated in chunks of at least this many
+static const int kMinGenerateChunk = 4096;
+
+// The gravitational constant the engine actually uses, see FewBodyEngine::CalculateGravity
+static const double kEngineG = PhysicsEngine::kG * 1000000000000;
+
+static const double kPi = 3.14159265358979323846;
+
+// Number of radii in the tables of the spherical models
+static const int kProfilePoints = 1024;
+
+// Innermost radius of the tables, in units of the scale radius
+static const double kMinProfileRadius = 1e-4;
+
+// Models without an edge are cut off where this much of the mass is enclosed
+static const double kMaxMassFraction = 0.999;
+
+// Attempts at a velocity before the last one is scaled down to fit
+static const int kMaxVelocityAttempts = 1000;
+
+// Shallowest and deepest King models accepted. Below the minimum the potential reaches
+// zero within the first integration step, leaving no profile to sample. At the maximum
+// the tidal radius is already thousands of core radii
+static const double kMinKingPotential = 0.1;
+static const double kMaxKingPotential = 12;
+
+// Thickness of the disk relative to its scale length
+static const double kDiskThickness = 0.1;
+
+// Random velocity of disk bodies relative to their circular velocity
+static const double kDiskDispersion = 0.1;
+
+static const char *kModelNames[MODEL_TYPE_COUNT] = {
+	"plummer", "hernquist", "nfw", "king", "disk", "box"
+};
+
+/**
+ * The SplitMix64 finaliser, which scrambles the bits of a counter into a random value.
+ */
+static uint64_t Mix(uint64_t z) {
+	z += 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+/**
+ * Counter based random numbers for one body. The n-th number drawn for a body only
+ * depends on the seed, the body and n, so bodies can be generated in any order.
+ */
+class CounterRng {
+public:
+	CounterRng(uint64_t seed, uint64_t body) : key_(Mix(Mix(seed) ^ body)), counter_(0) { }
+
+	// Uniform in [0, 1)
+	double Uniform() {
+		return (Mix(key_ + counter_++) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	// Standard normal, by the Box-Muller transform
+	double Gaussian() {
+		double radius = std::sqrt(-2 * std::log(1 - Uniform()));
+		return radius * std::cos(2 * kPi * Uniform());
+	}
+
+	// Uniform on the unit sphere
+	ofVec3f Direction() {
+		double z = 2 * Uniform() - 1;
+		double angle = 2 * kPi * Uniform();
+		double ring = std::sqrt(1 - z * z);
+		return ofVec3f(ring * std::cos(angle), ring * std::sin(angle), z);
+	}
+
+private:
+	uint64_t key_;
+	uint64_t counter_;
+};
+
+/**
+ * Tabulated radial structure of a spherical model in units where G, the total mass and
+ * the scale radius are 1. Radii are spaced evenly in log r.
+ */
+struct RadialProfile {
+	vector<double> radii;
+	// Fraction of the mass inside each radius, rising to 1 at the last one
+	vector<double> masses;
+	// Radial velocity dispersion squared, from the Jeans equation
+	vector<double> dispersions;
+	// Gravitational potential, or the King potential W for King models
+	vector<double> potentials;
+
+	/**
+	 * Interpolates a column of the table at a radius, clamped to the ends of the table.
+	 */
+	double Interpolate(const vector<double> &values, double radius) const {
+		if (radius <= radii.front()) {
+			return values.front();
+		}
+		if (radius >= radii.back()) {
+			return values.back();
+		}
+
+		size_t upper = std::upper_bound(radii.begin(), radii.end(), radius) - radii.begin();
+		double t = (radius - radii[upper - 1]) / (radii[upper] - radii[upper - 1]);
+		return values[upper - 1] + t * (values[upper] - values[upper - 1]);
+	}
+
+	/**
+	 * Returns the radius that encloses a fraction of the mass. Inside the first radius
+	 * the enclosed mass is taken to grow linearly from the center.
+	 */
+	double FindRadius(double fraction) const {
+		if (fraction <= masses.front()) {
+			return radii.front() * fraction / masses.front();
+		}
+
+		size_t upper = std::upper_bound(masses.begin(), masses.end(), fraction) - masses.begin();
+		if (upper >= masses.size()) {
+			return radii.back();
+		}
+		double t = (fraction - masses[upper - 1]) / (masses[upper] - masses[upper - 1]);
+		return radii[upper - 1] + t * (radii[upper] - radii[upper - 1]);
+	}
+};
+
+/**
+ * Tabulates a spherical model from its density and enclosed mass, cut off at a radius.
+ * The dispersion solves the Jeans equation for an isotropic model with no pressure at
+ * the cut off, and the potential is that of the enclosed mass alone outside it.
+ *
+ * @param density the density at a radius
+ * @param mass the mass inside a radius
+ * @param max_radius the radius of the edge of the model
+ */
+template <typename Density, typename Mass>
+static RadialProfile BuildProfile(Density density, Mass mass, double max_radius) {
+	RadialProfile profile;
+	profile.radii.resize(kProfilePoints);
+	profile.masses.resize(kProfilePoints);
+	profile.dispersions.resize(kProfilePoints);
+	profile.potentials.resize(kProfilePoints);
+
+	double total = mass(max_radius);
+	double log_step = std::log(max_radius / kMinProfileRadius) / (kProfilePoints - 1);
+	for (int i = 0; i < kProfilePoints; i++) {
+		profile.radii[i] = kMinProfileRadius * std::exp(i * log_step);
+		profile.masses[i] = mass(profile.radii[i]) / total;
+	}
+	profile.radii.back() = max_radius;
+	profile.masses.back() = 1;
+
+	// Integrate inwards from the edge, by the trapezoid rule in log r
+	double pressure = 0;
+	double potential = -1 / max_radius;
+	profile.dispersions.back() = 0;
+	profile.potentials.back() = potential;
+	for (int i = kProfilePoints - 2; i >= 0; i--) {
+		double r0 = profile.radii[i];
+		double r1 = profile.radii[i + 1];
+		double force0 = profile.masses[i] / (r0 * r0);
+		double force1 = profile.masses[i + 1] / (r1 * r1);
+
+		pressure += 0.5 * (density(r0) / total * force0 * r0 + density(r1) / total * force1 * r1) * log_step;
+		potential -= 0.5 * (force0 * r0 + force1 * r1) * log_step;
+		profile.dispersions[i] = pressure / (density(r0) / total);
+		profile.potentials[i] = potential;
+	}
+
+	return profile;
+}
+
+/**
+ * Solves the Poisson equation of a King model with central potential w0, in units of
+ * the King radius and the velocity dispersion parameter with G = 1, out to the tidal
+ * radius where the potential reaches zero.
+ *
+ * @param total_mass receives the mass of the model in the same units
+ */
+static RadialProfile BuildKingProfile(double w0, double &total_mass) {
+	// Density relative to the center, for a given potential
+	auto density = [w0](double w) {
+		if (w <= 0) {
+			return 0.0;
+		}
+		auto rho = [](double x) {
+			return std::exp(x) * std::erf(std::sqrt(x)) - std::sqrt(4 * x / kPi) * (1 + 2 * x / 3);
+		};
+		return rho(w) / rho(w0);
+	};
+
+	// W'' = -2 W' / r - 9 density(W), stepped with RK4 from the series solution near r = 0
+	const double step = 1e-3;
+	double r = step;
+	double w = w0 - 1.5 * r * r;
+	double dw = -3 * r;
+
+	vector<double> radii = { 0 };
+	vector<double> potentials = { w0 };
+	vector<double> masses = { 0 };
+	while (w > 0 && r < 1e4) {
+		radii.push_back(r);
+		potentials.push_back(w);
+		masses.push_back(-r * r * dw);
+
+		auto accel = [&density](double x, double y, double dy) {
+			return -2 * dy / x - 9 * density(y);
+		};
+		double k1w = dw;
+		double k1d = accel(r, w, dw);
+		double k2w = dw + 0.5 * step * k1d;
+		double k2d = accel(r + 0.5 * step, w + 0.5 * step * k1w, k2w);
+		double k3w = dw + 0.5 * step * k2d;
+		double k3d = accel(r + 0.5 * step, w + 0.5 * step * k2w, k3w);
+		double k4w = dw + step * k3d;
+		double k4d = accel(r + step, w + step * k3w, k4w);
+
+		double next_w = w + step / 6 * (k1w + 2 * k2w + 2 * k3w + k4w);
+		double next_dw = dw + step / 6 * (k1d + 2 * k2d + 2 * k3d + k4d);
+
+		// The tidal radius is where the potential crosses zero
+		if (next_w <= 0) {
+			double t = w / (w - next_w);
+			double tidal = r + t * step;
+			double tidal_dw = dw + t * (next_dw - dw);
+			radii.push_back(tidal);
+			potentials.push_back(0);
+			masses.push_back(-tidal * tidal * tidal_dw);
+			break;
+		}
+
+		w = next_w;
+		dw = next_dw;
+		r += step;
+	}
+
+	// Resample onto the usual table, spaced evenly in log r
+	RadialProfile profile;
+	total_mass = masses.back();
+	double max_radius = radii.back();
+	double log_step = std::log(max_radius / kMinProfileRadius) / (kProfilePoints - 1);
+	for (int i = 0; i < kProfilePoints; i++) {
+		double radius = (i == kProfilePoints - 1) ? max_radius : kMinProfileRadius * std::exp(i * log_step);
+		size_t upper = std::min(radii.size() - 1,
+								(size_t)(std::upper_bound(radii.begin(), radii.end(), radius) - radii.begin()));
+		double t = (radius - radii[upper - 1]) / (radii[upper] - radii[upper - 1]);
+
+		profile.radii.push_back(radius);
+		profile.masses.push_back((masses[upper - 1] + t * (masses[upper] - masses[upper - 1])) / total_mass);
+		profile.potentials.push_back(potentials[upper - 1] + t * (potentials[upper] - potentials[upper - 1]));
+	}
+	profile.masses.back() = 1;
+	profile.dispersions.assign(kProfilePoints, 0);
+
+	return profile;
+}
+
+/**
+ * Draws a velocity from a Gaussian of the given dispersion in each direction, redrawing
+ * any that would escape.
+ */
+static ofVec3f SampleBoundVelocity(CounterRng &rng, double dispersion, double escape_speed) {
+	double sigma = std::sqrt(std::max(0.0, dispersion));
+	ofVec3f velocity;
+	for (int attempt = 0; attempt < kMaxVelocityAttempts; attempt++) {
+		velocity = ofVec3f(rng.Gaussian() * sigma, rng.Gaussian() * sigma, rng.Gaussian() * sigma);
+		if (velocity.length() < escape_speed) {
+			return velocity;
+		}
+	}
+	return velocity.getNormalized() * (float)(0.99 * escape_speed);
+}
+
+/**
+ * Draws a speed from the lowered Maxwellian of a King model at potential w, in units of
+ * the velocity dispersion parameter: f(v) is proportional to v^2 (exp(w - v^2 / 2) - 1)
+ * up to the escape speed sqrt(2 w).
+ */
+static double SampleKingSpeed(CounterRng &rng, double w) {
+	double escape_speed = std::sqrt(2 * std::max(0.0, w));
+	if (escape_speed <= 0) {
+		return 0;
+	}
+
+	for (int attempt = 0; attempt < kMaxVelocityAttempts; attempt++) {
+		double speed;
+		double accept;
+		if (w > 1) {
+			// Propose from a Maxwellian, which bounds exp(w - v^2 / 2) from above
+			ofVec3f v(rng.Gaussian(), rng.Gaussian(), rng.Gaussian());
+			speed = v.length();
+			if (speed >= escape_speed) {
+				continue;
+			}
+			accept = 1 - std::exp(-(w - speed * speed / 2));
+		} else {
+			// Propose evenly below the escape speed, where f(v) <= v_esc^2 (exp(w) - 1)
+			speed = rng.Uniform() * escape_speed;
+			accept = speed * speed * (std::exp(w - speed * speed / 2) - 1)
+				/ (escape_speed * escape_speed * (std::exp(w) - 1));
+		}
+
+		if (rng.Uniform() < accept) {
+			return speed;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Returns the name of a model, as used on the command line.
+ */
+const char *InitialConditions::GetModelName(ModelType model) {
+	return (model >= 0 && model < MODEL_TYPE_COUNT) ? kModelNames[model] : "";
+}
+
+/**
+ * Looks up a model by its name.
+ *
+ * @param name the name of the model, as returned by GetModelName
+ * @param model receives the model
+ * @return false if there is no model of that name
+ */
+bool InitialConditions::ParseModel(const string &name, ModelType &model) {
+	for (int i = 0; i < MODEL_TYPE_COUNT; i++) {
+		if (name == kModelNames[i]) {
+			model = (ModelType)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Generates the bodies of a model, replacing any generated before. The models are
+ * built in units where G, the total mass and the scale radius are 1, tabulated once,
+ * and then sampled for every body in parallel and scaled to the settings.
+ *
+ * @param settings the model and its size
+ * @return false if the settings are out of range
+ */
+bool InitialConditions::Generate(const InitialConditionSettings &settings) {
+	if (settings.count <= 0 || settings.total_mass <= 0 || settings.scale <= 0
+		|| settings.model < 0 || settings.model >= MODEL_TYPE_COUNT
+		|| (settings.model == NFW && settings.concentration <= 0)
+		|| (settings.model == KING && (settings.concentration < kMinKingPotential
+									   || settings.concentration > kMaxKingPotential))) {
+		return false;
+	}
+
+	ModelType model = settings.model;
+	double scale = settings.scale;
+	double velocity_unit = std::sqrt(kEngineG * settings.total_mass / scale);
+
+	RadialProfile profile;
+	switch (model) {
+	case HERNQUIST: {
+		double max_radius = std::sqrt(kMaxMassFraction) / (1 - std::sqrt(kMaxMassFraction));
+		profile = BuildProfile([](double r) { return 1 / (2 * kPi * r * std::pow(1 + r, 3)); },
+							   [](double r) { return r * r / ((1 + r) * (1 + r)); }, max_radius);
+		break;
+	}
+
+	case NFW:
+		profile = BuildProfile([](double r) { return 1 / (4 * kPi * r * (1 + r) * (1 + r)); },
+							   [](double r) { return std::log(1 + r) - r / (1 + r); },
+							   settings.concentration);
+		break;
+
+	case KING: {
+		double king_mass;
+		profile = BuildKingProfile(settings.concentration, king_mass);
+		velocity_unit = std::sqrt(kEngineG * settings.total_mass / (king_mass * scale));
+		break;
+	}
+
+	case EXPONENTIAL_DISK:
+		profile = BuildProfile([](double r) { return std::exp(-r) / (2 * kPi); },
+							   [](double r) { return 1 - (1 + r) * std::exp(-r); },
+							   -std::log(1 - kMaxMassFraction) + 2);
+		break;
+
+	default:
+		break;
+	}
+
+	size_t count = (size_t)settings.count;
+	positions_.resize(count);
+	velocities_.resize(count);
+	masses_.assign(count, settings.total_mass / count);
+	colors_.resize(count);
+
+	ParallelFor(settings.count, kMinGenerateChunk, [&](int /*thread_idx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			CounterRng rng(settings.seed, (uint64_t)i);
+			ofVec3f position;
+			ofVec3f velocity;
+
+			switch (model) {
+			case PLUMMER: {
+				double fraction = std::max(1e-12, rng.Uniform() * kMaxMassFraction);
+				double r = 1 / std::sqrt(std::pow(fraction, -2.0 / 3.0) - 1);
+				position = rng.Direction() * r;
+
+				// Speed as a fraction of the escape speed, by rejection (Aarseth et al. 1974)
+				double q = 0;
+				for (int attempt = 0; attempt < kMaxVelocityAttempts; attempt++) {
+					q = rng.Uniform();
+					if (rng.Uniform() * 0.1 < q * q * std::pow(1 - q * q, 3.5)) {
+						break;
+					}
+				}
+				velocity = rng.Direction() * (q * std::sqrt(2.0) * std::pow(1 + r * r, -0.25));
+				break;
+			}
+
+			case HERNQUIST:
+			case NFW: {
+				double r = profile.FindRadius(rng.Uniform());
+				position = rng.Direction() * r;
+				double escape_speed = std::sqrt(-2 * profile.Interpolate(profile.potentials, r));
+				velocity = SampleBoundVelocity(rng, profile.Interpolate(profile.dispersions, r), escape_speed);
+				break;
+			}
+
+			case KING: {
+				double r = profile.FindRadius(rng.Uniform());
+				position = rng.Direction() * r;
+				velocity = rng.Direction() * SampleKingSpeed(rng, profile.Interpolate(profile.potentials, r));
+				break;
+			}
+
+			case EXPONENTIAL_DISK: {
+				double r = profile.FindRadius(rng.Uniform());
+				double angle = 2 * kPi * rng.Uniform();
+				double height = kDiskThickness * std::atanh(std::min(0.999999, std::max(-0.999999, 2 * rng.Uniform() - 1)));
+				position = ofVec3f(r * std::cos(angle), height, r * std::sin(angle));
+
+				// Circular velocity of the enclosed mass, as if it were spherical
+				double circular = std::sqrt(profile.Interpolate(profile.masses, r) / std::max(r, kMinProfileRadius));
+				double sigma = kDiskDispersion * circular;
+				velocity = ofVec3f(-std::sin(angle), 0, std::cos(angle)) * circular
+					+ ofVec3f(rng.Gaussian(), rng.Gaussian(), rng.Gaussian()) * sigma;
+				break;
+			}
+
+			case UNIFORM_BOX:
+				position = ofVec3f(2 * rng.Uniform() - 1, 2 * rng.Uniform() - 1, 2 * rng.Uniform() - 1);
+				break;
+
+			default:
+				break;
+			}
+
+			positions_[i] = position * scale;
+			velocities_[i] = velocity * velocity_unit;
+
+			// Warm in the middle, fading to blue at the edge
+			float t = (float)(position.length() / (position.length() + 1));
+			colors_[i] = ofColor(255 - 175 * t, 220 - 100 * t, 150 + 105 * t);
+		}
+	});
+
+	RemoveBulkMotion();
+	return true;
+}
+
+/**
+ * Adds the generated bodies to a simulation, after any bodies it already has.
+ */
+void InitialConditions::AddTo(PhysicsEngine &simulation) const {
+	simulation.AddBodies(GetPositions(), GetVelocities(), GetMasses(), GetColors());
+}
+
+ArrayView<ofVec3f> InitialConditions::GetPositions() const {
+	return ArrayView<ofVec3f>(positions_.data(), positions_.size());
+}
+
+ArrayView<ofVec3f> InitialConditions::GetVelocities() const {
+	return ArrayView<ofVec3f>(velocities_.data(), velocities_.size());
+}
+
+ArrayView<double> InitialConditions::GetMasses() const {
+	return ArrayView<double>(masses_.data(), masses_.size());
+}
+
+ArrayView<ofColor> InitialConditions::GetColors() const {
+	return ArrayView<ofColor>(colors_.data(), colors_.size());
+}
+
+/**
+ * Moves the bodies so that their center of mass is at rest at the origin. The sums
+ * are taken in body order on one thread, so they do not depend on the thread count.
+ */
+void InitialConditions::RemoveBulkMotion() {
+	double total = 0;
+	double center[3] = { 0, 0, 0 };
+	double momentum[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < positions_.size(); i++) {
+		total += masses_[i];
+		for (int axis = 0; axis < 3; axis++) {
+			center[axis] += masses_[i] * positions_[i][axis];
+			momentum[axis] += masses_[i] * velocities_[i][axis];
+		}
+	}
+
+	ofVec3f center_offset(center[0] / total, center[1] / total, center[2] / total);
+	ofVec3f velocity_offset(momentum[0] / total, momentum[1] / total, momentum[2] / total);
+	for (size_t i = 0; i < positions_.size(); i++) {
+		positions_[i] -= center_offset;
+		velocities_[i] -= velocity_offset;
+	}
+}
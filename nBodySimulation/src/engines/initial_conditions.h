@@ -0,0 +1,81 @@
+#pragma once
+
+#include "array_view.h"
+
+#include "ofVec3f.h"
+#include "ofColor.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class PhysicsEngine;
+
+/**
+ * The models InitialConditions can generate.
+ *
+ * PLUMMER - Plummer sphere in equilibrium, sampled from its distribution function
+ * HERNQUIST - Hernquist halo, velocities from the Jeans equation
+ * NFW - NFW halo cut off at the virial radius, velocities from the Jeans equation
+ * KING - King model, sampled from its lowered Maxwellian distribution function
+ * EXPONENTIAL_DISK - thin exponential disk in the xz plane, rotating around the y axis
+ * UNIFORM_BOX - bodies at rest spread evenly through a cube, for a cold collapse
+ */
+enum ModelType {
+	PLUMMER,
+	HERNQUIST,
+	NFW,
+	KING,
+	EXPONENTIAL_DISK,
+	UNIFORM_BOX,
+	MODEL_TYPE_COUNT
+};
+
+/**
+ * What to generate. The scale is the radius the model is built around: the Plummer or
+ * Hernquist scale radius, the NFW scale radius, the King core radius, the disk scale
+ * length or half the width of the box.
+ */
+struct InitialConditionSettings {
+	ModelType model = PLUMMER;
+	int count = 1000;
+	double total_mass = 1000;
+	double scale = 100;
+	// NFW concentration (virial over scale radius), or King central potential W0
+	double concentration = 10;
+	uint64_t seed = 1;
+};
+
+/**
+ * Generates the bodies of common initial conditions, in equilibrium under the engine's
+ * gravitational constant where the model has one.
+ *
+ * Every random number is derived from the seed, the index of the body and how many
+ * numbers that body has drawn so far, instead of from a shared generator. The bodies
+ * can therefore be generated in parallel in any order and come out the same for any
+ * number of threads.
+ */
+class InitialConditions {
+public:
+	static const char *GetModelName(ModelType model);
+	static bool ParseModel(const string &name, ModelType &model);
+
+	bool Generate(const InitialConditionSettings &settings);
+	void AddTo(PhysicsEngine &simulation) const;
+
+	ArrayView<ofVec3f> GetPositions() const;
+	ArrayView<ofVec3f> GetVelocities() const;
+	ArrayView<double> GetMasses() const;
+	ArrayView<ofColor> GetColors() const;
+
+private:
+	void RemoveBulkMotion();
+
+	vector<ofVec3f> positions_;
+	vector<ofVec3f> velocities_;
+	vector<double> masses_;
+	vector<ofColor> colors_;
+};
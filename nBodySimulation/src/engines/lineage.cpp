@@ -0,0 +1,176 @@
+#include "lineage.h"
+
+#include <cstring>
+
+const uint32_t LineageTable::kNone;
+
+/**
+ * Adds an entry for a new body. Ids are handed out in order, so the id must be the
+ * next one after the last body added.
+ *
+ * @param id the id of the new body
+ */
+void LineageTable::AddBody(uint32_t id) {
+	if (id >= parents_.size()) {
+		parents_.resize(id + 1, kNone);
+		first_children_.resize(id + 1, kNone);
+		next_siblings_.resize(id + 1, kNone);
+		merge_times_.resize(id + 1, 0);
+	}
+}
+
+/**
+ * Removes the entry of the most recently added body, for when a body is removed
+ * during setup before it could have been merged.
+ */
+void LineageTable::RemoveLastBody() {
+	if (!parents_.empty()) {
+		parents_.pop_back();
+		first_children_.pop_back();
+		next_siblings_.pop_back();
+		merge_times_.pop_back();
+	}
+}
+
+/**
+ * Records that one body was absorbed by another. The child is added to the front of
+ * its parent's list of children, so children are listed from the latest merge back.
+ *
+ * @param parent_id the id of the body that absorbed the other
+ * @param child_id the id of the body that was absorbed
+ * @param time the simulation time of the merge
+ */
+void LineageTable::RecordMerge(uint32_t parent_id, uint32_t child_id, double time) {
+	parents_[child_id] = parent_id;
+	merge_times_[child_id] = time;
+	next_siblings_[child_id] = first_children_[parent_id];
+	first_children_[parent_id] = child_id;
+}
+
+/**
+ * Removes every entry.
+ */
+void LineageTable::Clear() {
+	parents_.clear();
+	first_children_.clear();
+	next_siblings_.clear();
+	merge_times_.clear();
+}
+
+/**
+ * Returns the number of bodies that have an entry, merged or not.
+ */
+size_t LineageTable::CountBodies() const {
+	return parents_.size();
+}
+
+/**
+ * Returns true if the body has been absorbed by another body.
+ */
+bool LineageTable::IsMerged(uint32_t id) const {
+	return parents_[id] != kNone;
+}
+
+/**
+ * Returns the id of the body that absorbed this body, or kNone if it still exists.
+ */
+uint32_t LineageTable::GetParent(uint32_t id) const {
+	return parents_[id];
+}
+
+/**
+ * Returns the simulation time at which the body was absorbed. Only meaningful if
+ * IsMerged is true.
+ */
+double LineageTable::GetMergeTime(uint32_t id) const {
+	return merge_times_[id];
+}
+
+/**
+ * Returns the most recently absorbed child of a body, or kNone if it has absorbed none.
+ */
+uint32_t LineageTable::GetFirstChild(uint32_t id) const {
+	return first_children_[id];
+}
+
+/**
+ * Returns the child absorbed by the same parent just before this one, or kNone if
+ * this was the parent's first merge.
+ */
+uint32_t LineageTable::GetNextSibling(uint32_t id) const {
+	return next_siblings_[id];
+}
+
+/**
+ * Writes the table to a binary stream.
+ *
+ * Layout (little-endian): "NBLN", uint32 version, uint32 count, then the columns
+ * uint32 parent[count], uint32 first_child[count], uint32 next_sibling[count] and
+ * float64 merge_time[count].
+ *
+ * @param out the stream to write to, opened in binary mode
+ * @return true if the whole table was written
+ */
+bool LineageTable::Write(std::ostream &out) const {
+	uint32_t version = kVersion;
+	uint32_t count = (uint32_t)parents_.size();
+
+	out.write("NBLN", 4);
+	out.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char *>(parents_.data()), count * sizeof(uint32_t));
+	out.write(reinterpret_cast<const char *>(first_children_.data()), count * sizeof(uint32_t));
+	out.write(reinterpret_cast<const char *>(next_siblings_.data()), count * sizeof(uint32_t));
+	out.write(reinterpret_cast<const char *>(merge_times_.data()), count * sizeof(double));
+
+	return out.good();
+}
+
+/**
+ * Replaces the table with one read from a binary stream written by Write.
+ *
+ * @param in the stream to read from, opened in binary mode
+ * @param expected_count the number of bodies the table must hold, checked before
+ *        anything is allocated so a damaged count cannot ask for huge arrays
+ * @return true if a complete table was read whose links all name bodies in it,
+ *         otherwise the table is left empty
+ */
+bool LineageTable::Read(std::istream &in, uint32_t expected_count) {
+	char magic[4];
+	uint32_t version = 0;
+	uint32_t count = 0;
+
+	Clear();
+	in.read(magic, 4);
+	in.read(reinterpret_cast<char *>(&version), sizeof(version));
+	in.read(reinterpret_cast<char *>(&count), sizeof(count));
+	if (!in || std::memcmp(magic, "NBLN", 4) != 0 || version != kVersion || count != expected_count) {
+		return false;
+	}
+
+	parents_.resize(count);
+	first_children_.resize(count);
+	next_siblings_.resize(count);
+	merge_times_.resize(count);
+	in.read(reinterpret_cast<char *>(parents_.data()), count * sizeof(uint32_t));
+	in.read(reinterpret_cast<char *>(first_children_.data()), count * sizeof(uint32_t));
+	in.read(reinterpret_cast<char *>(next_siblings_.data()), count * sizeof(uint32_t));
+	in.read(reinterpret_cast<char *>(merge_times_.data()), count * sizeof(double));
+
+	if (!in) {
+		Clear();
+		return false;
+	}
+
+	// Every link must name a body in the table, or merges would write out of bounds
+	for (uint32_t id = 0; id < count; id++) {
+		if ((parents_[id] >= count && parents_[id] != kNone)
+			|| (first_children_[id] >= count && first_children_[id] != kNone)
+			|| (next_siblings_[id] >= count && next_siblings_[id] != kNone)) {
+			Clear();
+			return false;
+		}
+	}
+
+	return true;
+}
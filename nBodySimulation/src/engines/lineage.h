@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Records which bodies were merged into which, so that the accretion history of any
+ * body can be followed without comparing snapshots.
+ *
+ * When a body is absorbed in an inelastic collision, the absorbing body becomes its
+ * parent and the absorbed body becomes one of the parent's children. Every body id has
+ * one entry, and the children of a body form a linked list through the entries, so all
+ * queries take constant time. Each entry is stored as parallel columns of three ids
+ * and a merge time.
+ */
+class LineageTable {
+public:
+	// Marks a missing parent, child or sibling
+	static const uint32_t kNone = 0xFFFFFFFF;
+
+	// Building the table
+	void AddBody(uint32_t id);
+	void RemoveLastBody();
+	void RecordMerge(uint32_t parent_id, uint32_t child_id, double time);
+	void Clear();
+
+	// Queries
+	size_t CountBodies() const;
+	bool IsMerged(uint32_t id) const;
+	uint32_t GetParent(uint32_t id) const;
+	double GetMergeTime(uint32_t id) const;
+	uint32_t GetFirstChild(uint32_t id) const;
+	uint32_t GetNextSibling(uint32_t id) const;
+
+	// Serialization
+	bool Write(std::ostream &out) const;
+	bool Read(std::istream &in, uint32_t expected_count);
+
+private:
+	static const uint32_t kVersion = 1;
+
+	// The body each body was merged into, kNone while it still exists
+	vector<uint32_t> parents_;
+	// The most recently merged child of each body
+	vector<uint32_t> first_children_;
+	// The child merged into the same parent before this one
+	vector<uint32_t> next_siblings_;
+	// The simulation time of the merge, only meaningful for merged bodies
+	vector<double> merge_times_;
+};
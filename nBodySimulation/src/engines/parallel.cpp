@@ -0,0 +1,183 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread limit set by SetWorkerThreads, 0 if the hardware thread count is used
+static std::atomic<int> worker_threads(0);
+
+/**
+ * Returns the number of worker threads. Unless a limit has been set, this is the
+ * number of hardware threads reported by the system.
+ */
+int CountWorkerThreads() {
+	int threads = worker_threads;
+	if (threads > 0) {
+		return threads;
+	}
+
+	static const int hardware_threads = std::max(1, (int)std::thread::hardware_concurrency());
+	return hardware_threads;
+}
+
+/**
+ * Sets the number of worker threads. Useful for checking that results do not depend
+ * on the thread count, or for leaving cores free for other work.
+ *
+ * @param threads the maximum number of threads, or 0 to use every hardware thread
+ */
+void SetWorkerThreads(int threads) {
+	worker_threads = std::max(0, threads);
+}
+
+/**
+ * One call to ParallelFor, shared by the threads that work on it. Any thread may run any
+ * chunk, but each chunk runs exactly once and is always given its own index, so callers
+ * still see the same thread_idx for the same range of items.
+ */
+struct ParallelJob {
+	const std::function<void(int thread_idx, int begin, int end)> *task;
+	int count;
+	int chunk;
+	int chunk_count;
+	std::atomic<int> next_chunk;
+	std::atomic<int> done_chunks;
+	std::mutex mutex;
+	std::condition_variable finished;
+
+	/**
+	 * Runs chunks until none are left to claim.
+	 */
+	void RunChunks() {
+		for (int index = next_chunk++; index < chunk_count; index = next_chunk++) {
+			(*task)(index, index * chunk, std::min(count, (index + 1) * chunk));
+			if (++done_chunks == chunk_count) {
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.notify_all();
+			}
+		}
+	}
+};
+
+/**
+ * Threads that are started once and then wait for ParallelFor calls, so a call costs a
+ * wake-up instead of starting and joining threads. Several threads may call ParallelFor
+ * at the same time, such as the simulation thread and the viewer, and the workers share
+ * themselves between the calls.
+ */
+class WorkerPool {
+public:
+	explicit WorkerPool(int workers) : stopping_(false) {
+		for (int i = 0; i < workers; i++) {
+			workers_.emplace_back(&WorkerPool::WorkLoop, this);
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		job_added_.notify_all();
+		for (std::thread &worker : workers_) {
+			worker.join();
+		}
+	}
+
+	// Asks up to helpers workers to join in on a job. Asking for more helpers than there
+	// are workers would only leave requests behind that find the job already done
+	void Submit(const std::shared_ptr<ParallelJob> &job, int helpers) {
+		helpers = std::min(helpers, (int)workers_.size());
+		if (helpers <= 0) {
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (int i = 0; i < helpers; i++) {
+				jobs_.push_back(job);
+			}
+		}
+		job_added_.notify_all();
+	}
+
+private:
+	void WorkLoop() {
+		while (true) {
+			std::shared_ptr<ParallelJob> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				job_added_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+				if (stopping_) {
+					return;
+				}
+				job = jobs_.front();
+				jobs_.pop_front();
+			}
+
+			// The job may already be finished, in which case there is nothing to claim
+			job->RunChunks();
+		}
+	}
+
+	std::vector<std::thread> workers_;
+	std::deque<std::shared_ptr<ParallelJob>> jobs_;
+	std::mutex mutex_;
+	std::condition_variable job_added_;
+	bool stopping_;
+};
+
+/**
+ * Returns the pool, starting it on first use with a worker for every hardware thread
+ * besides the calling one.
+ */
+static WorkerPool &GetWorkerPool() {
+	static WorkerPool pool(std::max(1, (int)std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+/**
+ * Splits the range [0, count) into contiguous chunks and runs the task on each chunk
+ * in parallel on the worker pool. The calling thread works on the chunks as well, and
+ * the function returns once every chunk is done.
+ *
+ * Small ranges are run entirely on the calling thread, since waking the workers would
+ * cost more than the work itself.
+ *
+ * @param count the number of items to process
+ * @param min_chunk the smallest number of items worth giving to a thread
+ * @param task the function to run, given the chunk index and the chunk bounds
+ */
+void ParallelFor(int count, int min_chunk,
+				 const std::function<void(int thread_idx, int begin, int end)> &task) {
+	if (count <= 0) {
+		return;
+	}
+
+	int threads = std::min(CountWorkerThreads(), std::max(1, count / std::max(1, min_chunk)));
+	if (threads == 1) {
+		task(0, 0, count);
+		return;
+	}
+
+	std::shared_ptr<ParallelJob> job = std::make_shared<ParallelJob>();
+	job->task = &task;
+	job->count = count;
+	job->chunk = (count + threads - 1) / threads;
+	job->chunk_count = (count + job->chunk - 1) / job->chunk;
+	job->next_chunk = 0;
+	job->done_chunks = 0;
+
+	GetWorkerPool().Submit(job, job->chunk_count - 1);
+	job->RunChunks();
+
+	// Workers may still hold the job afterwards, but they no longer touch the task
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->finished.wait(lock, [&job] { return job->done_chunks == job->chunk_count; });
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <functional>
+
+/**
+ * Helpers for splitting loops over the bodies across the available hardware threads.
+ *
+ * Work is always divided into contiguous chunks in index order, so the chunk a body
+ * falls in only depends on the thread count. Callers that keep one buffer per thread
+ * can therefore concatenate those buffers in thread order and get a deterministic result.
+ *
+ * The chunks run on a pool of threads that is started once, and thread_idx is the index
+ * of the chunk rather than of the pool thread that happens to run it. Each index is used
+ * by one chunk at a time, so it can still pick a per-thread buffer.
+ */
+
+// Returns the number of threads that ParallelFor may use (always at least one)
+int CountWorkerThreads();
+
+// Limits the number of threads, or restores the hardware thread count when given 0
+void SetWorkerThreads(int threads);
+
+// Runs task(thread_idx, begin, end) over [0, count) using up to CountWorkerThreads() threads
+void ParallelFor(int count, int min_chunk,
+				 const std::function<void(int thread_idx, int begin, int end)> &task);
@@ -1,5 +1,32 @@
 #include "physics_engine.h"
+#include "parallel.h"
 
+#include <cmath>
+#include <cstring>
+
+// Radii of bulk added bodies are calculated in chunks of at least this many
+static const int kMinRadiusChunk = 16384;
+
+// Bytes each body takes up in a checkpoint, and in the lineage table after it
+static const uint64_t kCheckpointBodyBytes = 2 * sizeof(ofVec3f) + 2 * sizeof(double)
+	+ sizeof(ofColor) + sizeof(uint32_t);
+static const uint64_t kLineageBodyBytes = 3 * sizeof(uint32_t) + sizeof(double);
+
+/**
+ * Returns how many bytes are left to read in a stream, or 0 if the stream cannot tell.
+ * The read position is left where it was.
+ */
+static uint64_t CountBytesLeft(std::istream &in) {
+	std::streampos position = in.tellg();
+	if (position == std::streampos(-1)) {
+		return 0;
+	}
+
+	in.seekg(0, std::ios::end);
+	std::streampos end = in.tellg();
+	in.seekg(position);
+	return (in && end > position) ? (uint64_t)(end - position) : 0;
+}
 
 /**
  * Helper function that returns a radius given a mass based on the mass-density constant.
@@ -12,7 +39,18 @@ double PhysicsEngine::CalculateRadius(double mass) {
  * Constructor. Takes the time increment interval for the update function and the collision type.
  */
 PhysicsEngine::PhysicsEngine(double interval, bool elastic)
-	: time_interval_(interval), elastic_collisions_(elastic), time_(0), body_count_(0) { }
+	: event_log_(nullptr), version_(0), body_count_(0), next_id_(0), time_interval_(interval),
+	  time_(0), elastic_collisions_(elastic) { }
+
+/**
+ * Sets the log that collisions are recorded to. The log must outlive the engine,
+ * or be replaced by nullptr before it is destroyed.
+ *
+ * @param event_log the log to record to, or nullptr to stop recording
+ */
+void PhysicsEngine::SetEventLog(EventLog *event_log) {
+	event_log_ = event_log;
+}
 
 /**
  * Adds a body to the simulation
@@ -22,14 +60,19 @@ PhysicsEngine::PhysicsEngine(double interval, bool elastic)
  */
 void PhysicsEngine::AddBody(ofVec3f position, ofVec3f velocity, 
 		double mass, ofColor color) {
-	Body body;
-	body.mass = mass;
-	body.velocity = velocity;
-	body.position = position;
-	body.color = color;
-	bodies_.push_back(body);
+	positions_.push_back(position);
+	velocities_.push_back(velocity);
+	masses_.push_back(mass);
+	colors_.push_back(color);
+	radii_.push_back(CalculateRadius(mass));
+
+	ids_.push_back(next_id_);
+	lineage_.AddBody(next_id_);
+	changes_.push_back({ BodyChange::ADDED, next_id_, next_id_, radii_.back(), color });
+	next_id_++;
 
 	body_count_++;
+	version_++;
 }
 
 /**
@@ -45,31 +88,306 @@ void PhysicsEngine::AddBody(double x,   double y,   double z,
 	AddBody(ofVec3f(x, y, z), ofVec3f(v_x, v_y, v_z), mass, color);
 }
 
+/**
+ * Adds many bodies at once, such as a whole set of initial conditions. The arrays are
+ * copied in bulk and the radii are calculated in parallel, which is far faster than
+ * adding the bodies one at a time. No BodyChange is recorded for the new bodies.
+ *
+ * @param positions the initial position of each body
+ * @param velocities the initial velocity of each body
+ * @param masses the mass of each body
+ * @param colors the color of each body
+ */
+void PhysicsEngine::AddBodies(ArrayView<ofVec3f> positions, ArrayView<ofVec3f> velocities,
+							  ArrayView<double> masses, ArrayView<ofColor> colors) {
+	size_t first = positions_.size();
+	size_t count = positions.size();
+	if (count == 0) {
+		return;
+	}
+
+	positions_.insert(positions_.end(), positions.begin(), positions.end());
+	velocities_.insert(velocities_.end(), velocities.begin(), velocities.end());
+	masses_.insert(masses_.end(), masses.begin(), masses.end());
+	colors_.insert(colors_.end(), colors.begin(), colors.end());
+
+	radii_.resize(first + count);
+	ParallelFor((int)count, kMinRadiusChunk, [&](int /*thread_idx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			radii_[first + i] = CalculateRadius(masses[i]);
+		}
+	});
+
+	ids_.resize(first + count);
+	for (size_t i = 0; i < count; i++) {
+		ids_[first + i] = next_id_ + (uint32_t)i;
+	}
+	next_id_ += (uint32_t)count;
+	lineage_.AddBody(next_id_ - 1);
+
+	body_count_ += (int)count;
+	version_++;
+}
+
 /**
  * Removes the most recently added body.
  */
 void PhysicsEngine::RemovePreviousBody() {
-	if (!bodies_.empty()) {
-		bodies_.pop_back();
+	if (!ids_.empty()) {
+		changes_.push_back({ BodyChange::REMOVED, ids_.back(), ids_.back(), radii_.back(), colors_.back() });
+
+		// Hand the id back out if no body was added after this one
+		if (ids_.back() + 1 == next_id_) {
+			next_id_--;
+			lineage_.RemoveLastBody();
+		}
+
+		positions_.pop_back();
+		velocities_.pop_back();
+		masses_.pop_back();
+		colors_.pop_back();
+		ids_.pop_back();
+		radii_.pop_back();
 		body_count_--;
+		version_++;
 	}
 }
 
 /**
- * Returns a vector of all the positions of the bodies
+ * Writes everything the engine needs to carry on exactly where it is to a binary
+ * stream. Every value is stored as its bits, so an engine restored with ReadCheckpoint
+ * takes the same steps as this one would have, bit for bit. No part of the state is
+ * random, so there is no generator state to save.
+ *
+ * Layout (little-endian): "NBCK", uint32 version, uint64 count, float64 time,
+ * float64 interval, uint32 next id, uint32 flags (1 = elastic collisions), then the
+ * columns float32[3] position[count], float32[3] velocity[count], float64 mass[count],
+ * float64 radius[count], uint8[4] color[count], uint32 id[count], followed by the
+ * lineage table as written by LineageTable::Write.
+ *
+ * @param out the stream to write to, opened in binary mode
+ * @return true if the whole checkpoint was written
+ */
+bool PhysicsEngine::WriteCheckpoint(std::ostream &out) const {
+	uint32_t version = kCheckpointVersion;
+	uint64_t count = positions_.size();
+	uint32_t flags = elastic_collisions_ ? 1 : 0;
+
+	out.write("NBCK", 4);
+	out.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char *>(&time_), sizeof(time_));
+	out.write(reinterpret_cast<const char *>(&time_interval_), sizeof(time_interval_));
+	out.write(reinterpret_cast<const char *>(&next_id_), sizeof(next_id_));
+	out.write(reinterpret_cast<const char *>(&flags), sizeof(flags));
+	out.write(reinterpret_cast<const char *>(positions_.data()), count * sizeof(ofVec3f));
+	out.write(reinterpret_cast<const char *>(velocities_.data()), count * sizeof(ofVec3f));
+	out.write(reinterpret_cast<const char *>(masses_.data()), count * sizeof(double));
+	out.write(reinterpret_cast<const char *>(radii_.data()), count * sizeof(double));
+	out.write(reinterpret_cast<const char *>(colors_.data()), count * sizeof(ofColor));
+	out.write(reinterpret_cast<const char *>(ids_.data()), count * sizeof(uint32_t));
+
+	return out.good() && lineage_.Write(out);
+}
+
+/**
+ * Replaces the bodies and settings of the engine with a checkpoint written by
+ * WriteCheckpoint. No BodyChange is recorded; viewers notice the new bodies because
+ * the version changes.
+ *
+ * @param in the stream to read from, opened in binary mode. It must be seekable, so
+ *        the body count can be checked against the size of the data
+ * @return true if a complete checkpoint with valid ids was read, otherwise the engine
+ *         is unchanged
+ */
+bool PhysicsEngine::ReadCheckpoint(std::istream &in) {
+	char magic[4];
+	uint32_t version = 0;
+	uint64_t count = 0;
+	double time = 0;
+	double interval = 0;
+	uint32_t next_id = 0;
+	uint32_t flags = 0;
+
+	in.read(magic, 4);
+	in.read(reinterpret_cast<char *>(&version), sizeof(version));
+	in.read(reinterpret_cast<char *>(&count), sizeof(count));
+	in.read(reinterpret_cast<char *>(&time), sizeof(time));
+	in.read(reinterpret_cast<char *>(&interval), sizeof(interval));
+	in.read(reinterpret_cast<char *>(&next_id), sizeof(next_id));
+	in.read(reinterpret_cast<char *>(&flags), sizeof(flags));
+	if (!in || std::memcmp(magic, "NBCK", 4) != 0 || version != kCheckpointVersion
+		|| count > next_id) {
+		return false;
+	}
+
+	// A damaged count must not allocate more than the stream could possibly hold
+	if (count * kCheckpointBodyBytes + (uint64_t)next_id * kLineageBodyBytes > CountBytesLeft(in)) {
+		return false;
+	}
+
+	// Read into new arrays, so a truncated checkpoint leaves the engine as it was
+	vector<ofVec3f> positions(count);
+	vector<ofVec3f> velocities(count);
+	vector<double> masses(count);
+	vector<double> radii(count);
+	vector<ofColor> colors(count);
+	vector<uint32_t> ids(count);
+	LineageTable lineage;
+	in.read(reinterpret_cast<char *>(positions.data()), count * sizeof(ofVec3f));
+	in.read(reinterpret_cast<char *>(velocities.data()), count * sizeof(ofVec3f));
+	in.read(reinterpret_cast<char *>(masses.data()), count * sizeof(double));
+	in.read(reinterpret_cast<char *>(radii.data()), count * sizeof(double));
+	in.read(reinterpret_cast<char *>(colors.data()), count * sizeof(ofColor));
+	in.read(reinterpret_cast<char *>(ids.data()), count * sizeof(uint32_t));
+	if (!in || !lineage.Read(in, next_id)) {
+		return false;
+	}
+
+	// Ids index the lineage, so each must be one that was handed out, and only once
+	vector<bool> seen(next_id, false);
+	for (uint32_t id : ids) {
+		if (id >= next_id || seen[id]) {
+			return false;
+		}
+		seen[id] = true;
+	}
+
+	positions_.swap(positions);
+	velocities_.swap(velocities);
+	masses_.swap(masses);
+	radii_.swap(radii);
+	colors_.swap(colors);
+	ids_.swap(ids);
+	lineage_ = lineage;
+	changes_.clear();
+
+	body_count_ = (int)count;
+	next_id_ = next_id;
+	time_ = time;
+	time_interval_ = interval;
+	elastic_collisions_ = (flags & 1) != 0;
+	version_++;
+	return true;
+}
+
+/**
+ * Returns a copy of the positions of all the bodies. Prefer GetPositions, which
+ * does not copy, when the positions are only read.
  * @return a vector of updated positions
  */
 vector<ofVec3f> PhysicsEngine::GetBodyPositions() const {
-	vector<ofVec3f> positions;
-	for (Body m : bodies_) {
-		positions.push_back(m.position);
-	}
+	return positions_;
+}
+
+/**
+ * Returns a copy of the ids of all the bodies, in the same order as the positions
+ * @return a vector of body ids
+ */
+vector<uint32_t> PhysicsEngine::GetBodyIds() const {
+	return ids_;
+}
 
-	return positions;
+/**
+ * Returns the merge history of the bodies, indexed by body id.
+ */
+const LineageTable &PhysicsEngine::GetLineage() const {
+	return lineage_;
 }
+
 /**
  * Returns the total number of bodies in the simulation at the current time.
  */
 int PhysicsEngine::CountBodies() {
 	return body_count_;
+}
+
+/**
+ * Returns the simulation time that the current positions correspond to.
+ */
+double PhysicsEngine::GetTime() const {
+	return time_;
+}
+
+/**
+ * Returns the simulation time covered by one call to update.
+ */
+double PhysicsEngine::GetTimeInterval() const {
+	return time_interval_;
+}
+
+/**
+ * Returns the number of calls to update so far, worked out from the simulation time.
+ * A run restored from a checkpoint therefore carries on counting where it stopped.
+ */
+uint64_t PhysicsEngine::CountSteps() const {
+	return (uint64_t)std::llround(time_ / time_interval_);
+}
+
+/**
+ * Returns true if colliding bodies bounce off each other instead of merging.
+ */
+bool PhysicsEngine::HasElasticCollisions() const {
+	return elastic_collisions_;
+}
+
+/**
+ * Moves the changes made to the bodies since the last call onto the end of a list.
+ *
+ * @param changes the list the changes are appended to
+ */
+void PhysicsEngine::TakeBodyChanges(vector<BodyChange> &changes) {
+	changes.insert(changes.end(), changes_.begin(), changes_.end());
+	changes_.clear();
+}
+
+/**
+ * Returns a view of the positions of all the bodies.
+ */
+ArrayView<ofVec3f> PhysicsEngine::GetPositions() const {
+	return ArrayView<ofVec3f>(positions_.data(), positions_.size());
+}
+
+/**
+ * Returns a view of the velocities of all the bodies.
+ */
+ArrayView<ofVec3f> PhysicsEngine::GetVelocities() const {
+	return ArrayView<ofVec3f>(velocities_.data(), velocities_.size());
+}
+
+/**
+ * Returns a view of the masses of all the bodies.
+ */
+ArrayView<double> PhysicsEngine::GetMasses() const {
+	return ArrayView<double>(masses_.data(), masses_.size());
+}
+
+/**
+ * Returns a view of the radii of all the bodies.
+ */
+ArrayView<double> PhysicsEngine::GetRadii() const {
+	return ArrayView<double>(radii_.data(), radii_.size());
+}
+
+/**
+ * Returns a view of the colors of all the bodies.
+ */
+ArrayView<ofColor> PhysicsEngine::GetColors() const {
+	return ArrayView<ofColor>(colors_.data(), colors_.size());
+}
+
+/**
+ * Returns a view of the ids of all the bodies.
+ */
+ArrayView<uint32_t> PhysicsEngine::GetIds() const {
+	return ArrayView<uint32_t>(ids_.data(), ids_.size());
+}
+
+/**
+ * Returns a counter that changes every time the bodies change. Readers can compare it
+ * to a value saved earlier to tell whether their data is out of date. Views obtained
+ * before the version changed must not be used.
+ */
+uint64_t PhysicsEngine::GetVersion() const {
+	return version_;
 }
\ No newline at end of file
@@ -1,8 +1,44 @@
 #pragma once
 
+#include "array_view.h"
+#include "lineage.h"
+
 #include "ofVec3f.h"
 #include "ofColor.h"
 
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+class EventLog;
+
+/**
+ * A change to the set of bodies, identified by body id. Viewers apply these to their
+ * own per-body data instead of rebuilding it whenever the bodies change.
+ *
+ * ADDED - id was added to the end of the bodies
+ * REMOVED - id was removed
+ * MERGED - other_id was absorbed by id and removed
+ *
+ * The radius and color are the new values of id, for ADDED and MERGED.
+ *
+ * Bodies added in bulk with AddBodies are not listed one by one. Viewers notice them
+ * because their number of bodies no longer matches, and rebuild their data.
+ */
+struct BodyChange {
+	enum Type {
+		ADDED,
+		REMOVED,
+		MERGED
+	};
+
+	Type type;
+	uint32_t id;
+	uint32_t other_id;
+	double radius;
+	ofColor color;
+};
+
 /**
  * Base class for all n-body simulation implementations that contains
  * important core data points and required public methods.
@@ -11,8 +47,6 @@
  * a collision handling function.
  */
 class PhysicsEngine {
-	// Allows ColoredSphere to access the private Body struct. See "src/sphere.h"
-	friend struct ColoredSphere;
 public:
 	// Constants
 	// The default density of a body
@@ -21,6 +55,8 @@ public:
 	static constexpr double kG = 0.000000000066742;
 	// Default time interval for updating
 	static constexpr double kDefaultInterval = 0.02;
+	// Version of the checkpoint layout written by WriteCheckpoint
+	static const uint32_t kCheckpointVersion = 1;
 
 	// Static function used to scale body radius by mass
 	static double CalculateRadius(double mass);
@@ -32,35 +68,75 @@ public:
 	void AddBody(double x,   double y,   double z, 
 				 double v_x, double v_y, double v_z,
 				 double mass, ofColor color);
+	void AddBodies(ArrayView<ofVec3f> positions, ArrayView<ofVec3f> velocities,
+				   ArrayView<double> masses, ArrayView<ofColor> colors);
 	void RemovePreviousBody();
 	virtual void SetElasticCollisions(bool elastic) = 0;
+	void SetEventLog(EventLog *event_log);
 
 	// Main loop
 	virtual void update() = 0;
 
+	// Checkpoints of the complete state, for continuing a run later
+	bool WriteCheckpoint(std::ostream &out) const;
+	bool ReadCheckpoint(std::istream &in);
+
 	// Getters
 	vector<ofVec3f> GetBodyPositions() const;
+	vector<uint32_t> GetBodyIds() const;
+	const LineageTable &GetLineage() const;
 	int CountBodies();
-protected:
-	/**
-	 * Represents a body which has an associated mass, velocity and position.
-	 * The color is used simply to differentiate between the bodies.
-	 */
-	struct Body {
-		ofVec3f position;
-		ofVec3f velocity;
-		double mass;
-		ofColor color;
-	};
+	double GetTime() const;
+	double GetTimeInterval() const;
+	uint64_t CountSteps() const;
+	bool HasElasticCollisions() const;
+	void TakeBodyChanges(vector<BodyChange> &changes);
 
+	// Zero-copy views of the body arrays, valid until the version changes
+	ArrayView<ofVec3f> GetPositions() const;
+	ArrayView<ofVec3f> GetVelocities() const;
+	ArrayView<double> GetMasses() const;
+	ArrayView<double> GetRadii() const;
+	ArrayView<ofColor> GetColors() const;
+	ArrayView<uint32_t> GetIds() const;
+	uint64_t GetVersion() const;
+protected:
 	// All implementations must consider collisions, even if it does nothing
 	virtual void HandleCollisions() = 0;
 
-	// Stores the simulation bodies
-	vector<Body> bodies_;
+	/*
+	 * The simulation bodies, stored as one array per property. Index i of every array
+	 * describes the same body. Each body has a position, velocity and mass, and the
+	 * color is used simply to differentiate between the bodies.
+	 */
+	vector<ofVec3f> positions_;
+	vector<ofVec3f> velocities_;
+	vector<double> masses_;
+	vector<ofColor> colors_;
+
+	// Unique for the lifetime of the simulation, unlike the index of a body
+	vector<uint32_t> ids_;
+
+	// Radius of each body. Only recalculated when a mass changes so that the
+	// collision checks do not need to call CalculateRadius for every pair
+	vector<double> radii_;
+
+	// Changes to the bodies since the last call to TakeBodyChanges
+	vector<BodyChange> changes_;
+
+	// Merge history of every body that has been part of the simulation
+	LineageTable lineage_;
+
+	// Receives collision events if set, not owned by the engine
+	EventLog *event_log_;
+
+	// Incremented whenever the bodies change. Implementations must increment it at
+	// the end of update, after which earlier views of the arrays may be invalid
+	uint64_t version_;
 
 	// Auxiliary information
 	int body_count_;
+	uint32_t next_id_;
 	double time_interval_;
 	double time_;
 	bool elastic_collisions_;
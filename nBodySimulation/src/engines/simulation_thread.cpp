@@ -0,0 +1,369 @@
+#include "simulation_thread.h"
+#include "..\io\trajectory_writer.h"
+
+#include <algorithm>
+#include <chrono>
+
+constexpr double SimulationThread::kMaxDisplayDelay;
+
+/**
+ * Creates a paused simulation thread for an engine. Nothing runs until Start is called.
+ * The step count starts from the steps the engine has already taken, so the frames of
+ * a resumed run are numbered on from where it stopped.
+ *
+ * @param simulation the engine to run, which must outlive this object
+ */
+SimulationThread::SimulationThread(PhysicsEngine *simulation)
+	: simulation_(simulation), trajectory_writer_(nullptr), running_(false), pending_steps_(0),
+	  step_(simulation->CountSteps()), speed_(0), frame_budget_(kDefaultFrameBudget), accumulator_(0),
+	  last_frame_time_(0), speed_ratio_(0) { }
+
+/**
+ * Stops the thread if it is still running.
+ */
+SimulationThread::~SimulationThread() {
+	Stop();
+}
+
+/**
+ * Publishes the initial state and starts the thread. The simulation starts running
+ * immediately, as if Resume had been sent.
+ */
+void SimulationThread::Start() {
+	if (thread_.joinable()) {
+		return;
+	}
+
+	// The viewer builds its data from the first snapshot, so earlier changes are not needed
+	simulation_->TakeBodyChanges(pending_changes_);
+	pending_changes_.clear();
+
+	// Make sure the viewer has a state to show before the first step finishes
+	PublishSnapshot();
+
+	running_ = true;
+	thread_ = std::thread(&SimulationThread::Run, this);
+}
+
+/**
+ * Stops advancing the simulation after the current step.
+ */
+void SimulationThread::Pause() {
+	PushCommand({ Command::PAUSE, 0, 0.0 });
+}
+
+/**
+ * Continues advancing the simulation as fast as possible.
+ */
+void SimulationThread::Resume() {
+	PushCommand({ Command::RESUME, 0, 0.0 });
+}
+
+/**
+ * Advances a paused simulation by a number of steps.
+ *
+ * @param steps the number of steps to take
+ */
+void SimulationThread::Step(int steps) {
+	PushCommand({ Command::STEP, steps, 0.0 });
+}
+
+/**
+ * Sets how fast the simulation runs while it is not paused.
+ *
+ * @param speed simulation time per second of wall time, or 0 for as fast as possible
+ */
+void SimulationThread::SetSpeed(double speed) {
+	PushCommand({ Command::SET_SPEED, 0, speed });
+}
+
+/**
+ * Sets how much wall time each frame may spend on steps before publishing a snapshot.
+ * Shorter frames give the viewer more snapshots, longer ones spend less time copying.
+ *
+ * @param seconds the frame budget in seconds
+ */
+void SimulationThread::SetFrameBudget(double seconds) {
+	PushCommand({ Command::SET_FRAME_BUDGET, 0, seconds });
+}
+
+/**
+ * Sets the writer that records the state of the simulation after each step. Must be
+ * called before Start, and the writer must outlive the thread.
+ *
+ * @param writer the writer to capture the steps, or nullptr to record nothing
+ */
+void SimulationThread::SetTrajectoryWriter(TrajectoryWriter *writer) {
+	trajectory_writer_ = writer;
+}
+
+/**
+ * Returns the simulation time advanced per second of wall time, smoothed over the
+ * last few frames, or 0 while paused.
+ */
+double SimulationThread::GetSpeedRatio() const {
+	return speed_ratio_;
+}
+
+/**
+ * Stops the thread and waits for it to finish. The engine can be used or deleted by
+ * the caller once this returns.
+ */
+void SimulationThread::Stop() {
+	if (!thread_.joinable()) {
+		return;
+	}
+
+	PushCommand({ Command::STOP, 0, 0.0 });
+	thread_.join();
+}
+
+/**
+ * Finds the two snapshots on either side of the time the viewer should display, and
+ * hands back every snapshot older than those.
+ *
+ * The display time trails the current time by the average interval between the
+ * snapshots in the ring, so there is normally a newer snapshot to move towards. The
+ * newest snapshot is never handed back, so there is always something to draw once
+ * the thread has started.
+ *
+ * @param before set to the snapshot at or before the display time
+ * @param after set to the snapshot after the display time, or before if there is none
+ * @param changes replaced with the changes between the previous and the new before
+ * @return how far the display time is from before towards after, between 0 and 1
+ */
+double SimulationThread::AcquireSnapshots(const BodySnapshot *&before, const BodySnapshot *&after,
+										   vector<BodyChange> &changes) {
+	changes.clear();
+
+	size_t count = snapshots_.Count();
+	if (count == 0) {
+		before = nullptr;
+		after = nullptr;
+		return 0;
+	}
+
+	const BodySnapshot &newest = snapshots_.Get(count - 1);
+	double delay = 0;
+	if (count > 1) {
+		delay = (newest.wall_time - snapshots_.Get(0).wall_time) / (count - 1);
+	}
+	double display_time = Now() - std::min(delay, kMaxDisplayDelay);
+
+	// Drop the snapshots that the display time has moved past, collecting the changes
+	// leading up to the new oldest snapshot
+	size_t passed = 0;
+	while (passed + 1 < count && snapshots_.Get(passed + 1).wall_time <= display_time) {
+		passed++;
+
+		const vector<BodyChange> &passed_changes = snapshots_.Get(passed).changes;
+		changes.insert(changes.end(), passed_changes.begin(), passed_changes.end());
+	}
+	snapshots_.Release(passed);
+	count -= passed;
+
+	before = &snapshots_.Get(0);
+	after = (count > 1) ? &snapshots_.Get(1) : before;
+
+	double interval = after->wall_time - before->wall_time;
+	if (interval <= 0) {
+		return 1;
+	}
+
+	return std::max(0.0, std::min(1.0, (display_time - before->wall_time) / interval));
+}
+
+/**
+ * Returns the current time of a steady clock, in seconds.
+ */
+double SimulationThread::Now() {
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Body of the simulation thread. Applies the queued commands, then takes the steps
+ * owed in this frame until they run out or the frame budget is spent, and publishes
+ * the result.
+ */
+void SimulationThread::Run() {
+	last_frame_time_ = Now();
+
+	while (ApplyCommands()) {
+		double frame_start = Now();
+		double start_time = simulation_->GetTime();
+		double interval = simulation_->GetTimeInterval();
+
+		if (running_ && speed_ > 0) {
+			accumulator_ += (frame_start - last_frame_time_) * speed_;
+		}
+		last_frame_time_ = frame_start;
+
+		bool stepped = false;
+		do {
+			if (!IsStepOwed()) {
+				break;
+			}
+
+			simulation_->update();
+			simulation_->TakeBodyChanges(pending_changes_);
+			step_++;
+			stepped = true;
+
+			if (trajectory_writer_ != nullptr) {
+				trajectory_writer_->Capture(*simulation_, step_);
+			}
+
+			if (pending_steps_ > 0) {
+				pending_steps_--;
+			} else if (speed_ > 0) {
+				accumulator_ -= interval;
+			}
+		} while (Now() - frame_start < frame_budget_);
+
+		// Drop the time that did not fit in the budget, keeping at most one step owed
+		accumulator_ = std::min(accumulator_, interval);
+
+		if (stepped) {
+			PublishSnapshot();
+		}
+
+		WaitForNextFrame(frame_start);
+
+		double frame_time = Now() - frame_start;
+		if (running_ && frame_time > 0) {
+			double ratio = (simulation_->GetTime() - start_time) / frame_time;
+			speed_ratio_ = speed_ratio_ + kSpeedSmoothing * (ratio - speed_ratio_);
+		}
+	}
+}
+
+/**
+ * Checks whether another step should be taken in the current frame.
+ */
+bool SimulationThread::IsStepOwed() const {
+	if (pending_steps_ > 0) {
+		return true;
+	}
+	if (!running_) {
+		return false;
+	}
+
+	return speed_ <= 0 || accumulator_ >= simulation_->GetTimeInterval();
+}
+
+/**
+ * When running at a set speed, sleeps until the frame budget is used up and the next
+ * step is owed. Wakes up early if a command arrives.
+ *
+ * @param frame_start the time the current frame started
+ */
+void SimulationThread::WaitForNextFrame(double frame_start) {
+	if (!running_ || speed_ <= 0 || pending_steps_ > 0) {
+		return;
+	}
+
+	double step_due = Now() + (simulation_->GetTimeInterval() - accumulator_) / speed_;
+	double wake_time = std::max(frame_start + frame_budget_, step_due);
+
+	std::unique_lock<std::mutex> lock(commands_mutex_);
+	commands_ready_.wait_for(lock, std::chrono::duration<double>(wake_time - Now()),
+							 [this] { return !commands_.empty(); });
+}
+
+/**
+ * Adds a command to the queue and wakes the simulation thread if it is waiting.
+ */
+void SimulationThread::PushCommand(Command command) {
+	{
+		std::lock_guard<std::mutex> lock(commands_mutex_);
+		commands_.push_back(command);
+	}
+
+	commands_ready_.notify_one();
+}
+
+/**
+ * Applies every queued command. If the simulation is paused with no steps left, waits
+ * until a command arrives that gives it something to do.
+ *
+ * @return false if the thread should stop, true if it should take a step
+ */
+bool SimulationThread::ApplyCommands() {
+	std::unique_lock<std::mutex> lock(commands_mutex_);
+
+	while (true) {
+		while (!commands_.empty()) {
+			Command command = commands_.front();
+			commands_.pop_front();
+
+			switch (command.type) {
+			case Command::PAUSE:
+				running_ = false;
+				pending_steps_ = 0;
+				speed_ratio_ = 0;
+				break;
+
+			case Command::RESUME:
+				running_ = true;
+				break;
+
+			case Command::STEP:
+				pending_steps_ += command.steps;
+				break;
+
+			case Command::STOP:
+				return false;
+
+			case Command::SET_SPEED:
+				speed_ = std::max(0.0, command.value);
+				accumulator_ = 0;
+				break;
+
+			case Command::SET_FRAME_BUDGET:
+				frame_budget_ = std::max(0.001, command.value);
+				break;
+			}
+		}
+
+		if (running_ || pending_steps_ > 0) {
+			return true;
+		}
+
+		commands_ready_.wait(lock, [this] { return !commands_.empty(); });
+
+		// Time spent paused is not owed to the simulation
+		last_frame_time_ = Now();
+	}
+}
+
+/**
+ * Copies the current state of the engine into a free slot of the snapshot ring and
+ * publishes it to the viewer. Does nothing if the ring is full, in which case the
+ * pending changes are carried by the next snapshot that is published.
+ */
+void SimulationThread::PublishSnapshot() {
+	BodySnapshot *snapshot = snapshots_.BeginWrite();
+	if (snapshot == nullptr) {
+		return;
+	}
+
+	ArrayView<ofVec3f> positions = simulation_->GetPositions();
+	ArrayView<double> radii = simulation_->GetRadii();
+	ArrayView<ofColor> colors = simulation_->GetColors();
+	ArrayView<uint32_t> ids = simulation_->GetIds();
+
+	snapshot->time = simulation_->GetTime();
+	snapshot->wall_time = Now();
+	snapshot->step = step_;
+	snapshot->positions.assign(positions.begin(), positions.end());
+	snapshot->radii.assign(radii.begin(), radii.end());
+	snapshot->colors.assign(colors.begin(), colors.end());
+	snapshot->ids.assign(ids.begin(), ids.end());
+
+	// The slot's old changes were already read, so reuse its storage for the next ones
+	snapshot->changes.swap(pending_changes_);
+	pending_changes_.clear();
+
+	snapshots_.EndWrite();
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "physics_engine.h"
+#include "snapshot_ring.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class TrajectoryWriter;
+
+/**
+ * Runs a physics engine on its own thread so that the simulation speed does not
+ * depend on the frame rate of the viewer.
+ *
+ * The viewer controls the thread by sending commands, which are queued and applied
+ * between steps. After every step the thread copies the bodies into a timestamped
+ * snapshot and pushes it into a lock-free ring. If the viewer has not made room in
+ * the ring the snapshot is skipped, so the simulation never waits for the viewer.
+ *
+ * The viewer draws the state at a point slightly in the past, interpolating between
+ * the two snapshots on either side of it. This keeps the motion smooth at the display
+ * rate even when the snapshots arrive at irregular intervals. Each snapshot also
+ * carries the changes to the bodies since the one before it, so the viewer can keep
+ * its own per-body data in step without rebuilding it.
+ *
+ * The thread works in frames of a fixed wall time budget. A frame takes as many steps
+ * as fit in the budget and publishes a single snapshot at the end of it, so the cost
+ * of copying the bodies is shared by all of the steps in the frame. By default the
+ * simulation runs as fast as possible. Given a speed, the thread instead accumulates
+ * the simulation time owed for the wall time that passed and takes fixed steps until
+ * it is paid off, sleeping in between. Time that does not fit in the budget is
+ * dropped, so a machine that is too slow runs behind real time but does not fall
+ * further and further behind.
+ *
+ * While the thread is running, the engine must not be used by anyone else.
+ */
+class SimulationThread {
+public:
+	explicit SimulationThread(PhysicsEngine *simulation);
+	~SimulationThread();
+
+	// Commands, safe to call from the viewer thread
+	void Start();
+	void Pause();
+	void Resume();
+	void Step(int steps);
+	void Stop();
+	void SetSpeed(double speed);
+	void SetFrameBudget(double seconds);
+	void SetTrajectoryWriter(TrajectoryWriter *writer);
+
+	// Simulation time advanced per second of wall time while running
+	double GetSpeedRatio() const;
+
+	// Viewer side of the snapshot ring
+	double AcquireSnapshots(const BodySnapshot *&before, const BodySnapshot *&after,
+							vector<BodyChange> &changes);
+
+	// Shared clock for timestamping snapshots, in seconds
+	static double Now();
+
+private:
+	/**
+	 * A request from the viewer, applied by the simulation thread between steps.
+	 */
+	struct Command {
+		enum Type {
+			PAUSE,
+			RESUME,
+			STEP,
+			STOP,
+			SET_SPEED,
+			SET_FRAME_BUDGET
+		};
+
+		Type type;
+		int steps;
+		double value;
+	};
+
+	// Longest the viewer lags behind the newest snapshot, in seconds
+	static constexpr double kMaxDisplayDelay = 0.25;
+	// Default wall time spent on each frame, in seconds
+	static constexpr double kDefaultFrameBudget = 1.0 / 60;
+	// Weight of the newest frame in the smoothed speed ratio
+	static constexpr double kSpeedSmoothing = 0.1;
+
+	void Run();
+	bool IsStepOwed() const;
+	void WaitForNextFrame(double frame_start);
+	void PushCommand(Command command);
+	bool ApplyCommands();
+	void PublishSnapshot();
+
+	PhysicsEngine *simulation_;
+	std::thread thread_;
+
+	// Receives the state after every step if set, not owned by the thread
+	TrajectoryWriter *trajectory_writer_;
+
+	// Command queue, protected by commands_mutex_
+	std::mutex commands_mutex_;
+	std::condition_variable commands_ready_;
+	std::deque<Command> commands_;
+
+	// Only used by the simulation thread
+	bool running_;
+	int pending_steps_;
+	uint64_t step_;
+	// Simulation time per wall time second to run at, or 0 to run as fast as possible
+	double speed_;
+	double frame_budget_;
+	// Simulation time owed at the set speed, and when it was last topped up
+	double accumulator_;
+	double last_frame_time_;
+	// Changes not yet carried by a published snapshot
+	vector<BodyChange> pending_changes_;
+
+	// Snapshots on their way from the simulation to the viewer
+	SnapshotRing snapshots_;
+
+	// Written by the simulation thread, read by the viewer
+	std::atomic<double> speed_ratio_;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "physics_engine.h"
+
+#include "ofVec3f.h"
+#include "ofColor.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+/**
+ * A copy of the body state at one instant, holding everything the viewer needs to
+ * draw the bodies. All arrays are indexed like the engine's body arrays.
+ */
+struct BodySnapshot {
+	// Simulation time of the state
+	double time;
+	// Wall-clock time in seconds at which the state was published
+	double wall_time;
+	uint64_t step;
+	vector<ofVec3f> positions;
+	vector<double> radii;
+	vector<ofColor> colors;
+	vector<uint32_t> ids;
+	// Changes to the bodies since the previously published snapshot
+	vector<BodyChange> changes;
+};
+
+/**
+ * Lock-free single-producer, single-consumer ring of snapshots.
+ *
+ * The producer fills the slot returned by BeginWrite and publishes it with EndWrite.
+ * When the ring is full BeginWrite returns nullptr instead of waiting, so the
+ * producer is never blocked by a slow consumer. The consumer reads the published
+ * snapshots from the oldest (offset 0) to the newest, and hands slots back with
+ * Release. The slots are reused, so their arrays are only allocated while they grow.
+ */
+class SnapshotRing {
+public:
+	static const size_t kCapacity = 4;
+
+	SnapshotRing() : head_(0), tail_(0) { }
+
+	// Producer side
+	BodySnapshot *BeginWrite() {
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) == kCapacity) {
+			return nullptr;
+		}
+
+		return &slots_[head % kCapacity];
+	}
+
+	void EndWrite() {
+		head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer side
+	size_t Count() const {
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+	}
+
+	const BodySnapshot &Get(size_t offset) const {
+		return slots_[(tail_.load(std::memory_order_relaxed) + offset) % kCapacity];
+	}
+
+	void Release(size_t count) {
+		tail_.store(tail_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+private:
+	BodySnapshot slots_[kCapacity];
+
+	// Only written by the producer and the consumer respectively
+	std::atomic<size_t> head_;
+	std::atomic<size_t> tail_;
+};
@@ -0,0 +1,454 @@
+#include "headless.h"
+#include "engines\few_body.h"
+#include "io\checkpoint.h"
+#include "io\csv_importer.h"
+#include "io\indexed_trajectory.h"
+#include "io\snapshot.h"
+#include "io\trajectory_writer.h"
+#include "render\splat_renderer.h"
+#include "xml_helpers.h"
+
+#include "ofMain.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+
+/**
+ * Reads a comma separated list of numbers, such as the corners of a box.
+ *
+ * @param value the list
+ * @param count the number of numbers expected, or 0 for any number
+ * @param numbers receives the numbers
+ * @return false if an entry is not a number or the count is wrong
+ */
+static bool ParseNumbers(const string &value, size_t count, vector<double> &numbers) {
+	numbers.clear();
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t end = value.find(',', start);
+		if (end == string::npos) {
+			end = value.size();
+		}
+
+		string entry = value.substr(start, end - start);
+		char *entry_end;
+		double number = std::strtod(entry.c_str(), &entry_end);
+		if (entry.empty() || *entry_end != '\0') {
+			return false;
+		}
+
+		numbers.push_back(number);
+		start = end + 1;
+	}
+
+	return count == 0 || numbers.size() == count;
+}
+
+/**
+ * Reads a comma separated list of body ids.
+ *
+ * @param value the list
+ * @param ids receives the ids
+ * @return false if an entry is not a plain decimal integer that fits in 32 bits
+ */
+static bool ParseIds(const string &value, vector<uint32_t> &ids) {
+	ids.clear();
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t end = value.find(',', start);
+		if (end == string::npos) {
+			end = value.size();
+		}
+
+		// strtoul would accept signs and blanks, and wrap negative values around
+		string entry = value.substr(start, end - start);
+		if (entry.empty() || entry.find_first_not_of("0123456789") != string::npos) {
+			return false;
+		}
+
+		errno = 0;
+		unsigned long id = std::strtoul(entry.c_str(), nullptr, 10);
+		if (errno == ERANGE || id > 0xFFFFFFFFul) {
+			return false;
+		}
+
+		ids.push_back((uint32_t)id);
+		start = end + 1;
+	}
+
+	return true;
+}
+
+/**
+ * Creates the sink for a trajectory file, picked by its extension.
+ *
+ * @param path the path of the trajectory
+ * @param options the headless settings, for the error bounds of compressed files
+ * @return the new sink, owned by the caller
+ */
+static FrameSink *CreateFrameSink(const string &path, const HeadlessOptions &options) {
+	string extension = ofFilePath::getFileExt(path);
+	if (extension == "nbtz") {
+		return new CompressedFrameSink(path, options.position_error, options.velocity_error);
+	} else if (extension == "nbti") {
+		return new IndexedFrameSink(path);
+	}
+
+	return new RawFrameSink(path);
+}
+
+/**
+ * Checks whether the program was asked to run without a window.
+ *
+ * @param argc the argument count passed to main
+ * @param argv the arguments passed to main
+ * @return true if --headless is one of the arguments
+ */
+bool HeadlessOptions::IsHeadless(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "--headless") {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Reads the headless settings from the command line. Settings that are not given
+ * keep their default values.
+ *
+ * @param argc the argument count passed to main
+ * @param argv the arguments passed to main
+ * @param options receives the settings
+ * @return false if an argument is unknown, is missing its value or is out of range
+ */
+bool HeadlessOptions::Parse(int argc, char *argv[], HeadlessOptions &options) {
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--headless") {
+			continue;
+		}
+		if (arg == "--elastic") {
+			options.elastic = true;
+			continue;
+		}
+
+		// Every other setting takes a value
+		if (i + 1 >= argc) {
+			ofLogError() << "Missing value for " << arg;
+			return false;
+		}
+		string value = argv[++i];
+
+		if (arg == "--setup") {
+			options.setup_file = value;
+		} else if (arg == "--columns") {
+			options.columns = value;
+			CsvImporter importer;
+			if (!importer.MapColumns(value)) {
+				ofLogError() << "Invalid column mapping " << value;
+				return false;
+			}
+		} else if (arg == "--generate") {
+			options.generate = true;
+			if (!InitialConditions::ParseModel(value, options.generator.model)) {
+				ofLogError() << "Unknown model " << value;
+				return false;
+			}
+		} else if (arg == "--bodies") {
+			options.generator.count = std::atoi(value.c_str());
+		} else if (arg == "--mass") {
+			options.generator.total_mass = std::atof(value.c_str());
+		} else if (arg == "--scale") {
+			options.generator.scale = std::atof(value.c_str());
+		} else if (arg == "--concentration") {
+			options.generator.concentration = std::atof(value.c_str());
+		} else if (arg == "--seed") {
+			options.generator.seed = std::strtoull(value.c_str(), nullptr, 10);
+		} else if (arg == "--save-setup") {
+			options.save_setup_file = value;
+		} else if (arg == "--output") {
+			options.output_dir = value;
+		} else if (arg == "--format") {
+			options.format = value;
+		} else if (arg == "--frames") {
+			options.frames = std::atoi(value.c_str());
+		} else if (arg == "--steps") {
+			options.steps_per_frame = std::atoi(value.c_str());
+		} else if (arg == "--size") {
+			size_t separator = value.find('x');
+			if (separator == string::npos) {
+				ofLogError() << "Expected --size WIDTHxHEIGHT, got " << value;
+				return false;
+			}
+			options.width = std::atoi(value.substr(0, separator).c_str());
+			options.height = std::atoi(value.substr(separator + 1).c_str());
+		} else if (arg == "--distance") {
+			options.distance = (float)std::atof(value.c_str());
+		} else if (arg == "--latitude") {
+			options.latitude = (float)std::atof(value.c_str());
+		} else if (arg == "--orbit") {
+			options.orbit = (float)std::atof(value.c_str());
+		} else if (arg == "--exposure") {
+			options.exposure = (float)std::atof(value.c_str());
+		} else if (arg == "--trajectory") {
+			options.trajectory_file = value;
+		} else if (arg == "--every") {
+			options.trajectory_interval = std::atoi(value.c_str());
+		} else if (arg == "--position-error") {
+			options.position_error = std::atof(value.c_str());
+		} else if (arg == "--velocity-error") {
+			options.velocity_error = std::atof(value.c_str());
+		} else if (arg == "--checkpoint") {
+			options.checkpoint_file = value;
+		} else if (arg == "--checkpoint-every") {
+			options.checkpoint_interval = std::atoi(value.c_str());
+		} else if (arg == "--resume") {
+			options.resume_file = value;
+		} else if (arg == "--select-trajectory") {
+			options.select_file = value;
+		} else if (arg == "--select-every") {
+			options.select_interval = std::atoi(value.c_str());
+		} else if (arg.compare(0, 9, "--select-") == 0) {
+			// Selections take a list of numbers, which has to be complete
+			vector<double> numbers;
+			vector<uint32_t> ids;
+			if (arg == "--select-ids" && ParseIds(value, ids)) {
+				options.selector.AddIds(ids);
+			} else if (arg == "--select-box" && ParseNumbers(value, 6, numbers)) {
+				options.selector.AddBox(ofVec3f(numbers[0], numbers[1], numbers[2]),
+										ofVec3f(numbers[3], numbers[4], numbers[5]));
+			} else if (arg == "--select-sphere" && ParseNumbers(value, 4, numbers)) {
+				options.selector.AddSphere(ofVec3f(numbers[0], numbers[1], numbers[2]), (float)numbers[3]);
+			} else if (arg == "--select-mass" && ParseNumbers(value, 2, numbers)) {
+				options.selector.SetMassRange(numbers[0], numbers[1]);
+			} else {
+				ofLogError() << "Invalid argument " << arg << " " << value;
+				return false;
+			}
+		} else {
+			ofLogError() << "Unknown argument " << arg;
+			return false;
+		}
+	}
+
+	if (options.format != "png" && options.format != "ppm") {
+		ofLogError() << "Unknown image format " << options.format;
+		return false;
+	}
+
+	if (!options.select_file.empty() && options.selector.IsEmpty()) {
+		ofLogError() << "--select-trajectory needs --select-ids, --select-box, --select-sphere or --select-mass";
+		return false;
+	}
+
+	// Without frames, the run is only for writing the setup
+	if (options.frames < 0 || (options.frames == 0 && options.save_setup_file.empty())) {
+		ofLogError() << "--frames must be positive, or 0 with --save-setup";
+		return false;
+	}
+
+	// Values that do not parse read as 0, so they are caught here too
+	struct {
+		const char *name;
+		bool valid;
+	} ranges[] = {
+		{ "--steps", options.steps_per_frame > 0 },
+		{ "--every", options.trajectory_interval > 0 },
+		{ "--select-every", options.select_interval > 0 },
+		{ "--checkpoint-every", options.checkpoint_interval > 0 },
+		{ "--position-error", options.position_error > 0 },
+		{ "--velocity-error", options.velocity_error > 0 },
+		{ "--size", options.width > 0 && options.height > 0 },
+		{ "--distance", options.distance > 0 }
+	};
+	for (const auto &range : ranges) {
+		if (!range.valid) {
+			ofLogError() << range.name << " must be positive";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Loads or generates the initial conditions, then alternates between stepping the simulation and
+ * rendering a frame with the splat renderer until every frame is written. A run resumed
+ * from a checkpoint carries on from the frame the checkpoint was taken in.
+ *
+ * @param options the headless settings
+ * @return 0 on success, 1 if the setup could not be read or a frame could not be written
+ */
+int RunHeadless(const HeadlessOptions &options) {
+	FewBodyEngine simulation;
+	simulation.SetElasticCollisions(options.elastic);
+
+	// Every source adds its bodies in bulk. Anything that is not a checkpoint, snapshot,
+	// CSV table or generated model is read as XML
+	if (!options.resume_file.empty()) {
+		// A resumed run records only its own frames, so it must not replace the earlier ones
+		for (const string &file : { options.trajectory_file, options.select_file }) {
+			if (!file.empty() && ofFile::doesFileExist(file)) {
+				ofLogError() << "Not resuming, recording would overwrite " << file;
+				return 1;
+			}
+		}
+
+		if (!CheckpointFile::Read(ofToDataPath(options.resume_file), simulation)) {
+			ofLogError() << "Could not load " << options.resume_file;
+			return 1;
+		}
+	} else if (options.generate) {
+		InitialConditions initial_conditions;
+		if (!initial_conditions.Generate(options.generator)) {
+			ofLogError() << "Invalid settings for a " << InitialConditions::GetModelName(options.generator.model) << " model";
+			return 1;
+		}
+		initial_conditions.AddTo(simulation);
+	} else if (ofFilePath::getFileExt(options.setup_file) == "nbs") {
+		SnapshotFile snapshot;
+		if (!snapshot.Open(ofToDataPath(options.setup_file)) || !snapshot.Load(simulation)) {
+			ofLogError() << "Could not load " << options.setup_file;
+			return 1;
+		}
+	} else if (ofFilePath::getFileExt(options.setup_file) == "csv") {
+		CsvImporter importer;
+		importer.MapColumns(options.columns);
+		if (!importer.Load(ofToDataPath(options.setup_file), simulation)) {
+			if (importer.GetBadLine() != 0) {
+				ofLogError() << "Could not read line " << importer.GetBadLine() << " of " << options.setup_file;
+			} else {
+				ofLogError() << "Could not load " << options.setup_file;
+			}
+			return 1;
+		}
+	} else {
+		// Parse every body into arrays first, so the engine can take them all at once
+		XmlHelper xml(options.setup_file);
+		int bodies_count = xml.IsEmpty() ? 0 : xml.CountBodies();
+		vector<ofVec3f> positions(bodies_count);
+		vector<ofVec3f> velocities(bodies_count);
+		vector<double> masses(bodies_count);
+		vector<ofColor> colors(bodies_count);
+		for (int i = 0; i < bodies_count; i++) {
+			positions[i] = xml.GetPosition(i);
+			velocities[i] = xml.GetVelocity(i);
+			masses[i] = xml.GetMass(i);
+			colors[i] = xml.GetColor(i);
+		}
+
+		simulation.AddBodies(ArrayView<ofVec3f>(positions.data(), positions.size()),
+							 ArrayView<ofVec3f>(velocities.data(), velocities.size()),
+							 ArrayView<double>(masses.data(), masses.size()),
+							 ArrayView<ofColor>(colors.data(), colors.size()));
+	}
+
+	if (simulation.CountBodies() == 0) {
+		ofLogError() << "No bodies in " << options.setup_file;
+		return 1;
+	}
+
+	if (!options.save_setup_file.empty()
+		&& !SnapshotFile::Write(ofToDataPath(options.save_setup_file), simulation)) {
+		ofLogError() << "Could not write " << options.save_setup_file;
+		return 1;
+	}
+	if (options.frames == 0) {
+		return 0;
+	}
+
+	string output_dir = ofToDataPath(options.output_dir);
+	ofDirectory::createDirectory(output_dir, false, true);
+
+	// Recording runs on its own thread while the next steps are taken. The selected
+	// bodies get a writer of their own, usually with a much shorter interval
+	std::unique_ptr<FrameSink> trajectory_sink;
+	std::unique_ptr<TrajectoryWriter> trajectory_writer;
+	if (!options.trajectory_file.empty()) {
+		trajectory_sink.reset(CreateFrameSink(ofToDataPath(options.trajectory_file), options));
+		trajectory_writer.reset(new TrajectoryWriter(trajectory_sink.get(), options.trajectory_interval));
+	}
+
+	std::unique_ptr<FrameSink> select_sink;
+	std::unique_ptr<TrajectoryWriter> select_writer;
+	if (!options.select_file.empty()) {
+		select_sink.reset(CreateFrameSink(ofToDataPath(options.select_file), options));
+		select_writer.reset(new TrajectoryWriter(select_sink.get(), options.select_interval));
+		select_writer->SetSelector(&options.selector);
+	}
+
+	SplatRenderer renderer(options.width, options.height);
+	renderer.SetExposure(options.exposure);
+
+	// Frame n ends after step (n + 1) * steps_per_frame, so the steps taken tell which
+	// frame to carry on with. A checkpoint between two frames, such as one saved by the
+	// viewer, finishes the frame it is in with the steps that are left of it
+	ofPixels pixels;
+	uint64_t steps = simulation.CountSteps();
+	int first_frame = (int)(steps / options.steps_per_frame);
+	for (int frame = first_frame; frame < options.frames; frame++) {
+		uint64_t frame_end = (uint64_t)(frame + 1) * options.steps_per_frame;
+		while (steps < frame_end) {
+			simulation.update();
+			steps++;
+
+			if (trajectory_writer) {
+				trajectory_writer->Capture(simulation, steps);
+			}
+			if (select_writer) {
+				select_writer->Capture(simulation, steps);
+			}
+		}
+
+		renderer.SetCamera(SplatCamera::Orbit(options.distance, frame * options.orbit, options.latitude));
+		renderer.Render(simulation.GetPositions(), simulation.GetMasses(), simulation.GetColors());
+
+		string file_name = ofFilePath::join(output_dir,
+			"frame_" + ofToString(frame, 5, '0') + "." + options.format);
+
+		bool written;
+		if (options.format == "ppm") {
+			written = renderer.WritePpm(file_name);
+		} else {
+			// ofSaveImage does not report failure, so check for the file instead
+			pixels.setFromPixels(renderer.GetPixels().data(), renderer.GetWidth(),
+								 renderer.GetHeight(), OF_PIXELS_RGB);
+			ofSaveImage(pixels, file_name);
+			written = ofFile::doesFileExist(file_name, false);
+		}
+
+		if (!written) {
+			ofLogError() << "Could not write " << file_name;
+			return 1;
+		}
+
+		bool last_frame = (frame + 1 == options.frames);
+		if (!options.checkpoint_file.empty()
+			&& ((frame + 1) % options.checkpoint_interval == 0 || last_frame)
+			&& !CheckpointFile::Write(ofToDataPath(options.checkpoint_file), simulation)) {
+			ofLogError() << "Could not write " << options.checkpoint_file;
+			return 1;
+		}
+	}
+
+	if (trajectory_writer) {
+		trajectory_writer->Finish();
+		if (trajectory_writer->HasFailed()) {
+			ofLogError() << "Could not write " << options.trajectory_file;
+			return 1;
+		}
+	}
+
+	if (select_writer) {
+		select_writer->Finish();
+		if (select_writer->HasFailed()) {
+			ofLogError() << "Could not write " << options.select_file;
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "engines\initial_conditions.h"
+#include "io\compressed_trajectory.h"
+#include "io\output_selector.h"
+
+#include <string>
+
+using std::string;
+
+/**
+ * Settings for rendering a simulation to an image sequence without opening a window,
+ * read from the command line after --headless.
+ *
+ *   --setup FILE        initial conditions, as XML, as a binary .nbs snapshot or as a
+ *                       .csv table with one body per line
+ *   --columns MAPPING   columns of the .csv table that hold each property, such as
+ *                       x=pos_x,y=pos_y,z=pos_z,mass=3
+ *   --generate MODEL    generate the bodies instead: plummer, hernquist, nfw, king, disk or box
+ *   --bodies N          number of bodies to generate
+ *   --mass M            total mass of the generated bodies
+ *   --scale R           scale radius of the generated model
+ *   --concentration C   NFW concentration, or King central potential W0
+ *   --seed S            seed of the generated bodies
+ *   --save-setup FILE   write the initial bodies to a .nbs snapshot, and with --frames 0
+ *                       stop there
+ *   --output DIR        directory the frames are written to
+ *   --format png|ppm    image format of the frames
+ *   --frames N          number of frames to render
+ *   --steps N           simulation steps between frames
+ *   --size WxH          size of the frames in pixels
+ *   --distance D        distance of the camera from the origin
+ *   --latitude DEG      height of the camera above the xz plane
+ *   --orbit DEG         rotation of the camera around the y axis each frame
+ *   --exposure E        ratio of the brightest to the faintest visible pixel
+ *   --trajectory FILE   also record the state of the bodies to a trajectory file,
+ *                       compressed if the file name ends in .nbtz and indexed for
+ *                       seeking if it ends in .nbti
+ *   --every N           steps between the recorded states
+ *   --position-error E  largest error of a compressed position
+ *   --velocity-error E  largest error of a compressed velocity
+ *   --select-trajectory FILE  also record only the selected bodies to a second
+ *                       trajectory file, named like --trajectory
+ *   --select-every N    steps between the recorded states of the selected bodies
+ *   --select-ids A,B,..  select the bodies with these ids
+ *   --select-box X0,Y0,Z0,X1,Y1,Z1  select the bodies inside a box
+ *   --select-sphere X,Y,Z,R  select the bodies inside a sphere
+ *   --select-mass MIN,MAX  only select bodies in this mass range
+ *   --checkpoint FILE   save a checkpoint to FILE every few frames and at the end
+ *   --checkpoint-every N  frames between checkpoints
+ *   --resume FILE       continue the run saved in a checkpoint instead of --setup, from
+ *                       the frame its step count falls in. The trajectory files must not
+ *                       exist yet, they are never overwritten or appended to
+ *   --elastic           use elastic collisions
+ */
+struct HeadlessOptions {
+	string setup_file = "setup.xml";
+	string columns;
+	bool generate = false;
+	InitialConditionSettings generator;
+	string save_setup_file;
+	string output_dir = "frames";
+	string format = "png";
+	int frames = 600;
+	int steps_per_frame = 1;
+	int width = 1280;
+	int height = 720;
+	float distance = 500;
+	float latitude = 0;
+	float orbit = 0;
+	float exposure = 1000;
+	string trajectory_file;
+	int trajectory_interval = 1;
+	double position_error = CompressedFrameSink::kDefaultPositionError;
+	double velocity_error = CompressedFrameSink::kDefaultVelocityError;
+	string select_file;
+	int select_interval = 1;
+	OutputSelector selector;
+	string checkpoint_file;
+	int checkpoint_interval = 100;
+	string resume_file;
+	bool elastic = false;
+
+	static bool IsHeadless(int argc, char *argv[]);
+	static bool Parse(int argc, char *argv[], HeadlessOptions &options);
+};
+
+// Runs the simulation and writes one image per frame, returning the process exit code
+int RunHeadless(const HeadlessOptions &options);
@@ -0,0 +1,59 @@
+#include "checkpoint.h"
+#include "..\engines\physics_engine.h"
+
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+/**
+ * Replaces one file with another in a single step.
+ */
+static bool ReplaceFile(const string &from, const string &to) {
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+/**
+ * Writes the complete state of a simulation to a checkpoint file.
+ *
+ * @param path the path of the checkpoint, replaced only if the new one is complete
+ * @param simulation the simulation to save, which must not be stepping
+ * @return true if the checkpoint was written
+ */
+bool CheckpointFile::Write(const string &path, const PhysicsEngine &simulation) {
+	string temp_path = path + ".tmp";
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+		if (!simulation.WriteCheckpoint(out)) {
+			return false;
+		}
+
+		out.close();
+		if (out.fail()) {
+			return false;
+		}
+	}
+
+	return ReplaceFile(temp_path, path);
+}
+
+/**
+ * Restores a simulation from a checkpoint file.
+ *
+ * @param path the path of the checkpoint
+ * @param simulation the simulation to replace the state of
+ * @return false if the file is missing or not a complete checkpoint, in which case the
+ *         simulation is unchanged
+ */
+bool CheckpointFile::Read(const string &path, PhysicsEngine &simulation) {
+	std::ifstream in(path, std::ios::binary);
+	return in.is_open() && simulation.ReadCheckpoint(in);
+}
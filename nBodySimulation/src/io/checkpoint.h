@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+using std::string;
+
+class PhysicsEngine;
+
+/**
+ * Checkpoint files, from which a run can be continued exactly where it was stopped.
+ * The layout is that of PhysicsEngine::WriteCheckpoint.
+ *
+ * A checkpoint is first written next to its destination and only moved over it once
+ * it is complete, so a crash while writing never destroys the previous checkpoint.
+ */
+class CheckpointFile {
+public:
+	static bool Write(const string &path, const PhysicsEngine &simulation);
+	static bool Read(const string &path, PhysicsEngine &simulation);
+};
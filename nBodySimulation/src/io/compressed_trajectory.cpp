@@ -0,0 +1,495 @@
+#include "compressed_trajectory.h"
+#include "..\engines\parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+const uint32_t CompressedFrameSink::kBlockSize;
+
+// Frame flag marking a key frame
+static const uint32_t kKeyFrameFlag = 1;
+
+// Coordinates per body: position x, y, z and velocity x, y, z
+static const int kChannelCount = 6;
+
+// Quotients this large are not written in unary, the value follows as 64 raw bits
+static const int kMaxUnary = 32;
+
+// Smallest error bound accepted, so the grid never has a spacing of zero
+static const double kMinError = 1e-9;
+
+/**
+ * Appends bits to a byte buffer, lowest bit first.
+ */
+class BitWriter {
+public:
+	explicit BitWriter(vector<uint8_t> &out) : out_(out), accumulator_(0), bits_(0) { }
+
+	void Write(uint64_t value, int count) {
+		if (count > 32) {
+			Write(value & 0xFFFFFFFF, 32);
+			Write(value >> 32, count - 32);
+			return;
+		}
+
+		accumulator_ |= (value & ((1ull << count) - 1)) << bits_;
+		bits_ += count;
+		while (bits_ >= 8) {
+			out_.push_back((uint8_t)accumulator_);
+			accumulator_ >>= 8;
+			bits_ -= 8;
+		}
+	}
+
+	// Pads the last byte with zeros
+	void Flush() {
+		if (bits_ > 0) {
+			out_.push_back((uint8_t)accumulator_);
+			accumulator_ = 0;
+			bits_ = 0;
+		}
+	}
+
+private:
+	vector<uint8_t> &out_;
+	uint64_t accumulator_;
+	int bits_;
+};
+
+/**
+ * Reads bits written by a BitWriter. Reading past the end yields zeros and marks the
+ * reader as overrun instead of failing straight away.
+ */
+class BitReader {
+public:
+	BitReader(const char *data, size_t size)
+		: data_(reinterpret_cast<const uint8_t *>(data)), size_(size), position_(0),
+		  accumulator_(0), bits_(0), overrun_(false) { }
+
+	uint64_t Read(int count) {
+		if (count > 32) {
+			uint64_t low = Read(32);
+			return low | (Read(count - 32) << 32);
+		}
+
+		while (bits_ < count) {
+			if (position_ < size_) {
+				accumulator_ |= (uint64_t)data_[position_++] << bits_;
+			} else {
+				overrun_ = true;
+			}
+			bits_ += 8;
+		}
+
+		uint64_t value = accumulator_ & ((1ull << count) - 1);
+		accumulator_ >>= count;
+		bits_ -= count;
+		return value;
+	}
+
+	bool IsOverrun() const {
+		return overrun_;
+	}
+
+private:
+	const uint8_t *data_;
+	size_t size_;
+	size_t position_;
+	uint64_t accumulator_;
+	int bits_;
+	bool overrun_;
+};
+
+/**
+ * Maps signed integers to unsigned ones so that values near zero get small codes.
+ */
+static uint64_t ZigZag(int64_t value) {
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t UnZigZag(uint64_t value) {
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * Picks the Rice parameter for a set of values, close to log2 of their mean.
+ */
+static int ChooseRiceParameter(const vector<uint64_t> &values) {
+	double sum = 0;
+	for (uint64_t value : values) {
+		sum += (double)value;
+	}
+
+	double mean = values.empty() ? 0 : sum / values.size();
+	int k = 0;
+	while (k < 62 && (double)(1ull << (k + 1)) <= mean) {
+		k++;
+	}
+	return k;
+}
+
+static void WriteRice(BitWriter &bits, uint64_t value, int k) {
+	uint64_t quotient = value >> k;
+	if (quotient >= (uint64_t)kMaxUnary) {
+		bits.Write(0xFFFFFFFF, kMaxUnary);
+		bits.Write(value, 64);
+		return;
+	}
+
+	bits.Write((1ull << quotient) - 1, (int)quotient + 1);
+	bits.Write(value, k);
+}
+
+static uint64_t ReadRice(BitReader &bits, int k) {
+	uint64_t quotient = 0;
+	while (quotient < (uint64_t)kMaxUnary && bits.Read(1) == 1) {
+		quotient++;
+	}
+
+	if (quotient == (uint64_t)kMaxUnary) {
+		return bits.Read(64);
+	}
+	return (quotient << k) | bits.Read(k);
+}
+
+/**
+ * Returns one coordinate of a body, channels 0 to 2 being the position and 3 to 5
+ * the velocity.
+ */
+static float &Channel(TrajectoryFrame &frame, int channel, size_t idx) {
+	return channel < 3 ? frame.positions[idx][channel] : frame.velocities[idx][channel - 3];
+}
+
+static float Channel(const TrajectoryFrame &frame, int channel, size_t idx) {
+	return channel < 3 ? frame.positions[idx][channel] : frame.velocities[idx][channel - 3];
+}
+
+/**
+ * Encodes the coordinates of the bodies in [begin, end) and replaces them in decoded
+ * with the values the reader will get back. For a key frame decoded only needs to be
+ * the right size, otherwise it must hold the decoded values of the previous frame.
+ *
+ * @param steps the grid spacing of the positions and of the velocities
+ */
+static void EncodeBlock(const TrajectoryFrame &frame, TrajectoryFrame &decoded, bool key,
+						size_t begin, size_t end, const double steps[2], vector<uint8_t> &out) {
+	out.clear();
+	BitWriter bits(out);
+	vector<uint64_t> codes(end - begin);
+
+	for (int channel = 0; channel < kChannelCount; channel++) {
+		double step = steps[channel / 3];
+
+		// Key frames are coded from the corner of the bounding box, others from the last frame
+		double origin = 0;
+		if (key) {
+			origin = Channel(frame, channel, begin);
+			for (size_t i = begin; i < end; i++) {
+				origin = std::min(origin, (double)Channel(frame, channel, i));
+			}
+			uint64_t origin_bits;
+			std::memcpy(&origin_bits, &origin, sizeof(origin));
+			bits.Write(origin_bits, 64);
+		}
+
+		for (size_t i = begin; i < end; i++) {
+			float &value = Channel(decoded, channel, i);
+			double base = key ? origin : value;
+			int64_t quantised = std::llround((Channel(frame, channel, i) - base) / step);
+			value = (float)(base + quantised * step);
+			codes[i - begin] = key ? (uint64_t)quantised : ZigZag(quantised);
+		}
+
+		int k = ChooseRiceParameter(codes);
+		bits.Write(k, 6);
+		for (uint64_t code : codes) {
+			WriteRice(bits, code, k);
+		}
+	}
+
+	bits.Flush();
+}
+
+/**
+ * Decodes the coordinates of the bodies in [begin, end) into decoded, which must hold
+ * the previous frame unless this is a key frame.
+ *
+ * @return false if the block ended early
+ */
+static bool DecodeBlock(const char *data, size_t size, TrajectoryFrame &decoded, bool key,
+						size_t begin, size_t end, const double steps[2]) {
+	BitReader bits(data, size);
+
+	for (int channel = 0; channel < kChannelCount; channel++) {
+		double step = steps[channel / 3];
+
+		double origin = 0;
+		if (key) {
+			uint64_t origin_bits = bits.Read(64);
+			std::memcpy(&origin, &origin_bits, sizeof(origin));
+		}
+
+		int k = (int)bits.Read(6);
+		for (size_t i = begin; i < end; i++) {
+			float &value = Channel(decoded, channel, i);
+			uint64_t code = ReadRice(bits, k);
+			double base = key ? origin : value;
+			int64_t quantised = key ? (int64_t)code : UnZigZag(code);
+			value = (float)(base + quantised * step);
+		}
+	}
+
+	return !bits.IsOverrun();
+}
+
+/**
+ * Opens the output file and writes the header.
+ *
+ * @param path the file the frames are written to, replaced if it already exists
+ * @param position_error the largest error allowed in a decoded position, must be positive
+ * @param velocity_error the largest error allowed in a decoded velocity, must be positive
+ */
+CompressedFrameSink::CompressedFrameSink(const string &path, double position_error,
+										 double velocity_error)
+	: file_(path, std::ios::binary | std::ios::trunc),
+	  position_step_(2 * std::max(kMinError, position_error)),
+	  velocity_step_(2 * std::max(kMinError, velocity_error)),
+	  bytes_written_(0), has_decoded_(false), frames_since_key_(0) {
+	uint32_t version = kVersion;
+	uint32_t block_size = kBlockSize;
+	double errors[2] = { position_step_ / 2, velocity_step_ / 2 };
+
+	file_.write("NBTZ", 4);
+	file_.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	file_.write(reinterpret_cast<const char *>(errors), sizeof(errors));
+	file_.write(reinterpret_cast<const char *>(&block_size), sizeof(block_size));
+	bytes_written_ = 4 + sizeof(version) + sizeof(errors) + sizeof(block_size);
+}
+
+bool CompressedFrameSink::IsOpen() const {
+	return file_.is_open();
+}
+
+/**
+ * Encodes the blocks of a frame in parallel and appends them to the file.
+ */
+bool CompressedFrameSink::WriteFrame(const TrajectoryFrame &frame) {
+	uint64_t count = frame.positions.size();
+	bool key = IsKeyFrame(frame);
+	uint32_t flags = key ? kKeyFrameFlag : 0;
+	uint32_t block_count = (uint32_t)((count + kBlockSize - 1) / kBlockSize);
+
+	if (key) {
+		decoded_.positions.resize(count);
+		decoded_.velocities.resize(count);
+		decoded_.masses = frame.masses;
+		decoded_.ids = frame.ids;
+		frames_since_key_ = 0;
+	} else {
+		frames_since_key_++;
+	}
+	has_decoded_ = true;
+
+	double steps[2] = { position_step_, velocity_step_ };
+	blocks_.resize(block_count);
+	ParallelFor((int)block_count, 1, [&](int /*thread_idx*/, int begin_block, int end_block) {
+		for (int block = begin_block; block < end_block; block++) {
+			size_t begin = (size_t)block * kBlockSize;
+			size_t end = std::min((size_t)count, begin + kBlockSize);
+			EncodeBlock(frame, decoded_, key, begin, end, steps, blocks_[block]);
+		}
+	});
+
+	vector<uint64_t> block_sizes(block_count);
+	for (uint32_t block = 0; block < block_count; block++) {
+		block_sizes[block] = blocks_[block].size();
+	}
+
+	file_.write(reinterpret_cast<const char *>(&frame.step), sizeof(frame.step));
+	file_.write(reinterpret_cast<const char *>(&frame.time), sizeof(frame.time));
+	file_.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	file_.write(reinterpret_cast<const char *>(&flags), sizeof(flags));
+	file_.write(reinterpret_cast<const char *>(&block_count), sizeof(block_count));
+	file_.write(reinterpret_cast<const char *>(block_sizes.data()), block_count * sizeof(uint64_t));
+	bytes_written_ += sizeof(frame.step) + sizeof(frame.time) + sizeof(count) + sizeof(flags)
+		+ sizeof(block_count) + block_count * sizeof(uint64_t);
+
+	if (key) {
+		file_.write(reinterpret_cast<const char *>(frame.ids.data()), count * sizeof(uint32_t));
+		file_.write(reinterpret_cast<const char *>(frame.masses.data()), count * sizeof(double));
+		bytes_written_ += count * (sizeof(uint32_t) + sizeof(double));
+	}
+
+	for (const vector<uint8_t> &block : blocks_) {
+		file_.write(reinterpret_cast<const char *>(block.data()), block.size());
+		bytes_written_ += block.size();
+	}
+
+	return file_.good();
+}
+
+bool CompressedFrameSink::Finish() {
+	file_.flush();
+	return file_.good();
+}
+
+uint64_t CompressedFrameSink::GetBytesWritten() const {
+	return bytes_written_;
+}
+
+/**
+ * A frame must be a key frame if it cannot be coded against the one before it.
+ */
+bool CompressedFrameSink::IsKeyFrame(const TrajectoryFrame &frame) const {
+	return !has_decoded_ || frames_since_key_ + 1 >= kKeyFrameInterval
+		|| frame.ids != decoded_.ids || frame.masses != decoded_.masses;
+}
+
+CompressedTrajectoryReader::CompressedTrajectoryReader()
+	: file_size_(0), position_error_(0), velocity_error_(0), block_size_(0), has_decoded_(false) { }
+
+/**
+ * Opens a compressed trajectory and checks its header.
+ *
+ * @param path the path of the file
+ * @return false if the file is missing or is not a compressed trajectory of this version
+ */
+bool CompressedTrajectoryReader::Open(const string &path) {
+	file_.close();
+	file_.clear();
+	has_decoded_ = false;
+
+	file_.open(path, std::ios::binary);
+	char magic[4];
+	uint32_t version = 0;
+	double errors[2] = { 0, 0 };
+	file_.read(magic, 4);
+	file_.read(reinterpret_cast<char *>(&version), sizeof(version));
+	file_.read(reinterpret_cast<char *>(errors), sizeof(errors));
+	file_.read(reinterpret_cast<char *>(&block_size_), sizeof(block_size_));
+
+	if (!file_ || std::memcmp(magic, "NBTZ", 4) != 0
+		|| version != CompressedFrameSink::kVersion || block_size_ == 0) {
+		file_.close();
+		return false;
+	}
+
+	position_error_ = errors[0];
+	velocity_error_ = errors[1];
+
+	std::streampos header_end = file_.tellg();
+	file_.seekg(0, std::ios::end);
+	file_size_ = (uint64_t)file_.tellg();
+	file_.seekg(header_end);
+	return true;
+}
+
+/**
+ * Returns the number of bytes between the read position and the end of the file.
+ */
+uint64_t CompressedTrajectoryReader::CountBytesLeft() {
+	std::streampos position = file_.tellg();
+	if (position == std::streampos(-1) || (uint64_t)position > file_size_) {
+		return 0;
+	}
+	return file_size_ - (uint64_t)position;
+}
+
+/**
+ * Reads and decodes the next frame.
+ *
+ * @param frame receives the frame
+ * @return false at the end of the file, or if the frame is damaged. Sizes are checked
+ *         against the rest of the file before anything is allocated for them
+ */
+bool CompressedTrajectoryReader::ReadFrame(TrajectoryFrame &frame) {
+	uint64_t count = 0;
+	uint32_t flags = 0;
+	uint32_t block_count = 0;
+
+	file_.read(reinterpret_cast<char *>(&frame.step), sizeof(frame.step));
+	file_.read(reinterpret_cast<char *>(&frame.time), sizeof(frame.time));
+	file_.read(reinterpret_cast<char *>(&count), sizeof(count));
+	file_.read(reinterpret_cast<char *>(&flags), sizeof(flags));
+	file_.read(reinterpret_cast<char *>(&block_count), sizeof(block_count));
+	if (!file_ || block_count != (count + block_size_ - 1) / block_size_) {
+		return false;
+	}
+
+	bool key = (flags & kKeyFrameFlag) != 0;
+	if (!key && (!has_decoded_ || count != decoded_.positions.size())) {
+		return false;
+	}
+
+	// A damaged count must not allocate more than the file could possibly hold
+	uint64_t table_bytes = (uint64_t)block_count * sizeof(uint64_t)
+		+ (key ? count * (sizeof(uint32_t) + sizeof(double)) : 0);
+	if (table_bytes > CountBytesLeft()) {
+		return false;
+	}
+
+	block_sizes_.resize(block_count);
+	file_.read(reinterpret_cast<char *>(block_sizes_.data()), block_count * sizeof(uint64_t));
+
+	if (key) {
+		decoded_.positions.resize(count);
+		decoded_.velocities.resize(count);
+		decoded_.ids.resize(count);
+		decoded_.masses.resize(count);
+		file_.read(reinterpret_cast<char *>(decoded_.ids.data()), count * sizeof(uint32_t));
+		file_.read(reinterpret_cast<char *>(decoded_.masses.data()), count * sizeof(double));
+	}
+
+	// Each block starts where the one before it ends, and the last must end in the file
+	uint64_t bytes_left = CountBytesLeft();
+	vector<uint64_t> offsets(block_count + 1, 0);
+	for (uint32_t block = 0; block < block_count; block++) {
+		if (block_sizes_[block] > bytes_left - offsets[block]) {
+			has_decoded_ = false;
+			return false;
+		}
+		offsets[block + 1] = offsets[block] + block_sizes_[block];
+	}
+
+	payload_.resize(offsets.back());
+	file_.read(payload_.data(), payload_.size());
+	if (!file_) {
+		has_decoded_ = false;
+		return false;
+	}
+
+	double steps[2] = { 2 * position_error_, 2 * velocity_error_ };
+	std::atomic<bool> complete(true);
+	ParallelFor((int)block_count, 1, [&](int /*thread_idx*/, int begin_block, int end_block) {
+		for (int block = begin_block; block < end_block; block++) {
+			size_t begin = (size_t)block * block_size_;
+			size_t end = std::min((size_t)count, begin + block_size_);
+			if (!DecodeBlock(payload_.data() + offsets[block], block_sizes_[block], decoded_,
+							 key, begin, end, steps)) {
+				complete = false;
+			}
+		}
+	});
+
+	if (!complete) {
+		has_decoded_ = false;
+		return false;
+	}
+
+	has_decoded_ = true;
+	frame.positions = decoded_.positions;
+	frame.velocities = decoded_.velocities;
+	frame.masses = decoded_.masses;
+	frame.ids = decoded_.ids;
+	return true;
+}
+
+double CompressedTrajectoryReader::GetPositionError() const {
+	return position_error_;
+}
+
+double CompressedTrajectoryReader::GetVelocityError() const {
+	return velocity_error_;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "trajectory_writer.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * Writes frames with lossy compression of the positions and velocities, for runs
+ * where the raw trajectory would be too large to store.
+ *
+ * The bodies are split into blocks that are encoded independently, and in parallel.
+ * Within a block every coordinate is quantised to a grid whose spacing is twice the
+ * chosen error bound, so no decoded value is further from the original than the bound
+ * (plus the rounding to float). A key frame stores each coordinate relative to the
+ * lowest value in its block, the corner of the block's bounding box. Other frames
+ * store the difference to the value decoded from the frame before, which is small
+ * for bodies that move smoothly. Either way the integers are mapped to unsigned ones
+ * and Rice coded, with a code parameter picked per block and coordinate.
+ *
+ * Ids and masses are stored exactly, and only in key frames. A key frame is written
+ * whenever they change, such as after a merge, and at least every kKeyFrameInterval
+ * frames so a damaged frame does not spoil the rest of the file.
+ *
+ * File layout (little-endian):
+ *   header: "NBTZ", uint32 version, float64 position error, float64 velocity error,
+ *           uint32 block size
+ *   frame: uint64 step, float64 time, uint64 count, uint32 flags (1 = key frame),
+ *          uint32 block count, uint64 block bytes[block count],
+ *          key frames only: uint32 id[count], float64 mass[count],
+ *          then the encoded blocks one after the other
+ *   block: for each of position x, y, z and velocity x, y, z, a bit stream of
+ *          key frames only: float64 bounding box corner, then uint6 Rice parameter k
+ *          and one code per body, padded to a whole byte at the end of the block
+ */
+class CompressedFrameSink : public FrameSink {
+public:
+	static const uint32_t kVersion = 1;
+	// Bodies per block, the unit that is encoded and decoded in parallel
+	static const uint32_t kBlockSize = 4096;
+	// Most frames written in a row without a key frame
+	static const int kKeyFrameInterval = 100;
+	// Default error bounds, in the units of the positions and velocities
+	static constexpr double kDefaultPositionError = 0.01;
+	static constexpr double kDefaultVelocityError = 0.001;
+
+	CompressedFrameSink(const string &path, double position_error, double velocity_error);
+
+	bool IsOpen() const;
+	bool WriteFrame(const TrajectoryFrame &frame) override;
+	bool Finish() override;
+
+	// Size of the file so far, for reporting the compression achieved
+	uint64_t GetBytesWritten() const;
+
+private:
+	bool IsKeyFrame(const TrajectoryFrame &frame) const;
+
+	std::ofstream file_;
+	double position_step_;
+	double velocity_step_;
+	uint64_t bytes_written_;
+
+	// The previous frame as the reader will decode it, which the next one is coded against
+	TrajectoryFrame decoded_;
+	bool has_decoded_;
+	int frames_since_key_;
+
+	// Encoded blocks of the frame being written
+	vector<vector<uint8_t>> blocks_;
+};
+
+/**
+ * Reads back the frames written by a CompressedFrameSink, in order. The blocks of each
+ * frame are decoded in parallel.
+ */
+class CompressedTrajectoryReader {
+public:
+	CompressedTrajectoryReader();
+
+	bool Open(const string &path);
+	bool ReadFrame(TrajectoryFrame &frame);
+
+	double GetPositionError() const;
+	double GetVelocityError() const;
+
+private:
+	uint64_t CountBytesLeft();
+
+	std::ifstream file_;
+	uint64_t file_size_;
+	double position_error_;
+	double velocity_error_;
+	uint32_t block_size_;
+
+	// The frame decoded last, which the next one is decoded against
+	TrajectoryFrame decoded_;
+	bool has_decoded_;
+
+	vector<uint64_t> block_sizes_;
+	vector<char> payload_;
+};
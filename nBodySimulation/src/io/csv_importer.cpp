@@ -0,0 +1,395 @@
+#include "csv_importer.h"
+#include "..\engines\parallel.h"
+#include "..\engines\physics_engine.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// Chunks per thread, so a thread that finishes early can take another
+static const int kChunksPerThread = 4;
+
+// Files smaller than this are parsed as a single chunk
+static const size_t kMinChunkBytes = 1 << 16;
+
+// Delimiter that stands for any run of spaces and tabs
+static const char kWhitespace = ' ';
+
+static const char *kDefaultColumns[CSV_FIELD_COUNT] = {
+	"x", "y", "z", "vx", "vy", "vz", "mass", "r", "g", "b"
+};
+
+/**
+ * Returns the end of the line starting at a position, not including the newline.
+ */
+static const char *FindLineEnd(const char *line, const char *end) {
+	const char *newline = static_cast<const char *>(std::memchr(line, '\n', end - line));
+	return newline != nullptr ? newline : end;
+}
+
+/**
+ * Skips spaces, tabs and carriage returns, but never a newline.
+ */
+static const char *SkipBlanks(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * Whether a line holds no body, because it is blank or a comment.
+ */
+static bool IsSkipped(const char *line, const char *line_end) {
+	line = SkipBlanks(line, line_end);
+	return line == line_end || *line == '#';
+}
+
+/**
+ * Moves past the current field and its delimiter.
+ *
+ * @return the start of the next field, or line_end if there is none
+ */
+static const char *NextField(const char *p, const char *line_end, char delimiter) {
+	if (delimiter == kWhitespace) {
+		while (p < line_end && *p != ' ' && *p != '\t') {
+			p++;
+		}
+		return SkipBlanks(p, line_end);
+	}
+
+	const char *next = static_cast<const char *>(std::memchr(p, delimiter, line_end - p));
+	return next != nullptr ? next + 1 : line_end;
+}
+
+/**
+ * Returns the text of a field with blanks and quotes around it removed.
+ */
+static string FieldText(const char *p, const char *line_end, char delimiter) {
+	p = SkipBlanks(p, line_end);
+	const char *end = p;
+	while (end < line_end && *end != delimiter && *end != '\n'
+		   && !(delimiter == kWhitespace && *end == '\t')) {
+		end++;
+	}
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+		end--;
+	}
+	if (end - p >= 2 && *p == '"' && end[-1] == '"') {
+		p++;
+		end--;
+	}
+	return string(p, end);
+}
+
+/**
+ * Parses the number at the start of a field. strtod stops at the delimiter or at the
+ * newline, so it never reads past the end of the line. The file is mapped without a
+ * terminating zero, so a last line without a newline must be copied before parsing.
+ *
+ * @return false if the field does not start with a number
+ */
+static bool ParseNumber(const char *p, const char *line_end, double &value) {
+	p = SkipBlanks(p, line_end);
+	if (p < line_end && *p == '"') {
+		p++;
+	}
+	if (p >= line_end || *p == ',' || *p == ';' || *p == '\t') {
+		return false;
+	}
+
+	char *end;
+	value = std::strtod(p, &end);
+	return end != p && end <= line_end;
+}
+
+CsvImporter::CsvImporter() : delimiter_(','), bad_line_(0) {
+	for (int field = 0; field < CSV_FIELD_COUNT; field++) {
+		columns_[field] = kDefaultColumns[field];
+	}
+}
+
+/**
+ * Changes which columns hold which properties.
+ *
+ * @param mapping comma separated pairs of a property and a column, such as
+ *        "x=pos_x,y=pos_y,z=pos_z,mass=3". The properties are named like the default
+ *        columns, and a column is given by its header name or its number
+ * @return false if a property is unknown, in which case nothing was changed
+ */
+bool CsvImporter::MapColumns(const string &mapping) {
+	string columns[CSV_FIELD_COUNT];
+	std::copy(columns_, columns_ + CSV_FIELD_COUNT, columns);
+
+	size_t start = 0;
+	while (start < mapping.size()) {
+		size_t end = mapping.find(',', start);
+		if (end == string::npos) {
+			end = mapping.size();
+		}
+
+		string pair = mapping.substr(start, end - start);
+		size_t equals = pair.find('=');
+		if (equals == string::npos) {
+			return false;
+		}
+
+		string name = pair.substr(0, equals);
+		const char **field = std::find_if(kDefaultColumns, kDefaultColumns + CSV_FIELD_COUNT,
+										  [&name](const char *column) { return name == column; });
+		if (field == kDefaultColumns + CSV_FIELD_COUNT) {
+			return false;
+		}
+
+		columns[field - kDefaultColumns] = pair.substr(equals + 1);
+		start = end + 1;
+	}
+
+	std::copy(columns, columns + CSV_FIELD_COUNT, columns_);
+	return true;
+}
+
+/**
+ * Reads the bodies of a file and adds them to a simulation, after any bodies it
+ * already has.
+ *
+ * @param path the path of the file
+ * @param simulation the simulation to add the bodies to
+ * @return false if the file is missing, a required column is missing, or a line could
+ *         not be parsed (see GetBadLine), in which case nothing was added
+ */
+bool CsvImporter::Load(const string &path, PhysicsEngine &simulation) {
+	bad_line_ = 0;
+	if (!file_.Open(path)) {
+		return false;
+	}
+
+	const char *data = file_.GetData();
+	const char *end = data + file_.GetSize();
+
+	// The first line that is not skipped decides the delimiter and may be a header
+	const char *first = data;
+	size_t first_line = 1;
+	while (first < end && IsSkipped(first, FindLineEnd(first, end))) {
+		first = FindLineEnd(first, end) + 1;
+		first_line++;
+	}
+	if (first >= end) {
+		file_.Close();
+		return false;
+	}
+
+	const char *first_end = FindLineEnd(first, end);
+	delimiter_ = kWhitespace;
+	for (char delimiter : { ',', ';', '\t' }) {
+		if (std::memchr(first, delimiter, first_end - first) != nullptr) {
+			delimiter_ = delimiter;
+			break;
+		}
+	}
+
+	double number;
+	bool has_header = !ParseNumber(first, first_end, number);
+	if (!ResolveColumns(first, first_end, has_header)) {
+		file_.Close();
+		bad_line_ = first_line;
+		return false;
+	}
+
+	const char *body_start = has_header ? std::min(end, first_end + 1) : first;
+	size_t body_line = has_header ? first_line + 1 : first_line;
+
+	// Split the rest into chunks that start at the beginning of a line
+	size_t size = end - body_start;
+	int chunk_count = (int)std::max<size_t>(1, std::min<size_t>(CountWorkerThreads() * kChunksPerThread,
+																size / kMinChunkBytes));
+	chunks_.assign(chunk_count, Chunk());
+	const char *chunk_begin = body_start;
+	for (int i = 0; i < chunk_count; i++) {
+		const char *chunk_end = end;
+		if (i + 1 < chunk_count) {
+			chunk_end = std::max(chunk_begin, body_start + size * (i + 1) / chunk_count);
+			chunk_end = std::min(end, FindLineEnd(chunk_end, end) + 1);
+		}
+		chunks_[i] = { chunk_begin, chunk_end, 0, 0, 0, 0, 0 };
+		chunk_begin = chunk_end;
+	}
+
+	ParallelFor(chunk_count, 1, [this](int /*thread_idx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			CountBodies(chunks_[i]);
+		}
+	});
+
+	size_t body_count = 0;
+	for (Chunk &chunk : chunks_) {
+		chunk.first_line = body_line;
+		chunk.first_body = body_count;
+		body_line += chunk.line_count;
+		body_count += chunk.body_count;
+	}
+
+	positions_.resize(body_count);
+	velocities_.assign(body_count, ofVec3f(0, 0, 0));
+	masses_.resize(body_count);
+	colors_.assign(body_count, ofColor(255, 255, 255));
+
+	ParallelFor(chunk_count, 1, [this](int /*thread_idx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			ParseChunk(chunks_[i]);
+		}
+	});
+	file_.Close();
+
+	for (const Chunk &chunk : chunks_) {
+		if (chunk.bad_line != 0) {
+			bad_line_ = chunk.bad_line;
+			return false;
+		}
+	}
+
+	simulation.AddBodies(ArrayView<ofVec3f>(positions_.data(), positions_.size()),
+						 ArrayView<ofVec3f>(velocities_.data(), velocities_.size()),
+						 ArrayView<double>(masses_.data(), masses_.size()),
+						 ArrayView<ofColor>(colors_.data(), colors_.size()));
+
+	// The arrays are only needed until the engine has its own copy
+	vector<ofVec3f>().swap(positions_);
+	vector<ofVec3f>().swap(velocities_);
+	vector<double>().swap(masses_);
+	vector<ofColor>().swap(colors_);
+	return true;
+}
+
+size_t CsvImporter::GetBadLine() const {
+	return bad_line_;
+}
+
+/**
+ * Works out which column holds each property, from the header or from the column
+ * numbers given to MapColumns.
+ *
+ * @param header the first line of the file
+ * @param header_end the end of that line
+ * @param has_header whether the first line names the columns
+ * @return false if a position or the mass has no column
+ */
+bool CsvImporter::ResolveColumns(const char *header, const char *header_end, bool has_header) {
+	vector<string> names;
+	for (const char *p = SkipBlanks(header, header_end); p < header_end; p = NextField(p, header_end, delimiter_)) {
+		names.push_back(FieldText(p, header_end, delimiter_));
+	}
+
+	column_fields_.assign(names.size(), -1);
+	for (int field = 0; field < CSV_FIELD_COUNT; field++) {
+		const string &column = columns_[field];
+		int index = -1;
+
+		char *end;
+		long number = std::strtol(column.c_str(), &end, 10);
+		if (!column.empty() && *end == '\0') {
+			index = (int)number;
+		} else if (has_header) {
+			index = (int)(std::find(names.begin(), names.end(), column) - names.begin());
+		} else if (column == kDefaultColumns[field]) {
+			// Files without a header hold the default columns in order
+			index = field;
+		}
+
+		if (index >= 0 && index < (int)names.size()) {
+			column_fields_[index] = field;
+		} else if (field == CSV_X || field == CSV_Y || field == CSV_Z || field == CSV_MASS) {
+			return false;
+		}
+	}
+
+	// Columns after the last one that is used are never looked at
+	while (!column_fields_.empty() && column_fields_.back() < 0) {
+		column_fields_.pop_back();
+	}
+	return true;
+}
+
+/**
+ * First pass over a chunk, counting its lines and the bodies among them.
+ */
+void CsvImporter::CountBodies(Chunk &chunk) const {
+	for (const char *line = chunk.begin; line < chunk.end;) {
+		const char *line_end = FindLineEnd(line, chunk.end);
+		chunk.line_count++;
+		if (!IsSkipped(line, line_end)) {
+			chunk.body_count++;
+		}
+		line = line_end + 1;
+	}
+}
+
+/**
+ * Second pass over a chunk, parsing each body into its place in the arrays. Stops at
+ * the first line that cannot be parsed.
+ */
+void CsvImporter::ParseChunk(Chunk &chunk) {
+	const char *file_end = file_.GetData() + file_.GetSize();
+	size_t body = chunk.first_body;
+	size_t line_number = chunk.first_line;
+
+	for (const char *line = chunk.begin; line < chunk.end; line_number++) {
+		const char *line_end = FindLineEnd(line, chunk.end);
+		if (!IsSkipped(line, line_end)) {
+			bool parsed;
+			if (line_end == file_end) {
+				string last_line(line, line_end);
+				parsed = ParseLine(last_line.c_str(), last_line.c_str() + last_line.size(), body);
+			} else {
+				parsed = ParseLine(line, line_end, body);
+			}
+
+			if (!parsed) {
+				chunk.bad_line = line_number;
+				return;
+			}
+			body++;
+		}
+		line = line_end + 1;
+	}
+}
+
+/**
+ * Parses the columns of one line that hold a property into the arrays.
+ *
+ * @return false if a used column is missing or is not a number
+ */
+bool CsvImporter::ParseLine(const char *line, const char *line_end, size_t body) {
+	const char *p = SkipBlanks(line, line_end);
+	for (size_t column = 0; column < column_fields_.size(); column++) {
+		int field = column_fields_[column];
+		if (field >= 0) {
+			double value;
+			if (!ParseNumber(p, line_end, value)) {
+				return false;
+			}
+
+			switch (field) {
+			case CSV_X: positions_[body].x = (float)value; break;
+			case CSV_Y: positions_[body].y = (float)value; break;
+			case CSV_Z: positions_[body].z = (float)value; break;
+			case CSV_VX: velocities_[body].x = (float)value; break;
+			case CSV_VY: velocities_[body].y = (float)value; break;
+			case CSV_VZ: velocities_[body].z = (float)value; break;
+			case CSV_MASS: masses_[body] = value; break;
+			case CSV_RED: colors_[body].r = (unsigned char)std::min(255.0, std::max(0.0, value)); break;
+			case CSV_GREEN: colors_[body].g = (unsigned char)std::min(255.0, std::max(0.0, value)); break;
+			case CSV_BLUE: colors_[body].b = (unsigned char)std::min(255.0, std::max(0.0, value)); break;
+			}
+		}
+
+		if (column + 1 < column_fields_.size()) {
+			p = NextField(p, line_end, delimiter_);
+			if (p >= line_end) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include "ofVec3f.h"
+#include "ofColor.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class PhysicsEngine;
+
+/**
+ * The body properties a CSV column can hold.
+ */
+enum CsvField {
+	CSV_X,
+	CSV_Y,
+	CSV_Z,
+	CSV_VX,
+	CSV_VY,
+	CSV_VZ,
+	CSV_MASS,
+	CSV_RED,
+	CSV_GREEN,
+	CSV_BLUE,
+	CSV_FIELD_COUNT
+};
+
+/**
+ * Reads bodies from a table of text, one body per line, such as a CSV file.
+ *
+ * The fields of a line are separated by commas, semicolons or tabs, or by spaces if
+ * the first line has none of those. Blank lines and lines starting with # are skipped.
+ * If the first line is not made of numbers it is taken as a header naming the columns.
+ *
+ * Each property is found by the name of its column in the header or by its position,
+ * counting from 0. By default the columns are named x, y, z, vx, vy, vz, mass, r, g and
+ * b, or are in that order in a file without a header. Positions and masses are
+ * required, velocities default to 0 and colors to white.
+ *
+ * The file is memory mapped and split into chunks at line boundaries that are parsed
+ * in parallel. A first pass counts the bodies in each chunk so the second can parse
+ * every chunk straight into its place in the arrays.
+ */
+class CsvImporter {
+public:
+	CsvImporter();
+
+	bool MapColumns(const string &mapping);
+	bool Load(const string &path, PhysicsEngine &simulation);
+
+	// Line of the file that could not be read by the last Load, counting from 1, or 0
+	size_t GetBadLine() const;
+
+private:
+	/**
+	 * A range of lines of the file, and what the first pass found in it.
+	 */
+	struct Chunk {
+		const char *begin;
+		const char *end;
+		// Line number of the first line, counting from 1
+		size_t first_line;
+		size_t line_count;
+		size_t body_count;
+		// Index of the first body of the chunk in the arrays
+		size_t first_body;
+		// Line that could not be parsed, or 0
+		size_t bad_line;
+	};
+
+	bool ResolveColumns(const char *header, const char *header_end, bool has_header);
+	void CountBodies(Chunk &chunk) const;
+	void ParseChunk(Chunk &chunk);
+	bool ParseLine(const char *line, const char *line_end, size_t body);
+
+	// Header name or column number of each field, as given to MapColumns
+	string columns_[CSV_FIELD_COUNT];
+
+	// The field each column holds, or -1, for the file being loaded
+	vector<int> column_fields_;
+	char delimiter_;
+
+	MappedFile file_;
+	vector<Chunk> chunks_;
+	size_t bad_line_;
+
+	vector<ofVec3f> positions_;
+	vector<ofVec3f> velocities_;
+	vector<double> masses_;
+	vector<ofColor> colors_;
+};
@@ -0,0 +1,122 @@
+#include "event_log.h"
+
+#include <chrono>
+#include <cstring>
+
+/**
+ * Opens the log file, writes the header and starts the background writer.
+ *
+ * @param path the file the events are written to
+ * @param append whether to add the events after those already in the file, such as
+ *        the log of the part of a run before it was resumed. Otherwise the file is
+ *        replaced. The header is only written to an empty file
+ * @param capacity the number of events the ring can hold, rounded up to a power of two
+ */
+EventLog::EventLog(const string &path, bool append, size_t capacity)
+	: file_(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc)),
+	  head_(0), tail_(0), running_(true) {
+	size_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	ring_.resize(size);
+	mask_ = size - 1;
+
+	file_.seekp(0, std::ios::end);
+	if (file_ && file_.tellp() == std::streampos(0)) {
+		uint32_t version = kVersion;
+		uint32_t record_size = kRecordSize;
+		file_.write("NBEV", 4);
+		file_.write(reinterpret_cast<const char *>(&version), sizeof(version));
+		file_.write(reinterpret_cast<const char *>(&record_size), sizeof(record_size));
+	}
+
+	writer_ = std::thread(&EventLog::WriteLoop, this);
+}
+
+/**
+ * Stops the writer once every recorded event has been written, then closes the file.
+ */
+EventLog::~EventLog() {
+	running_ = false;
+	writer_.join();
+}
+
+/**
+ * Returns true if the log file could be opened for writing.
+ */
+bool EventLog::IsOpen() const {
+	return file_.is_open();
+}
+
+/**
+ * Adds an event to the ring. Only waits if the writer has fallen a whole ring behind.
+ *
+ * @param event the event to record
+ */
+void EventLog::Record(const CollisionEvent &event) {
+	size_t head = head_.load(std::memory_order_relaxed);
+	while (head - tail_.load(std::memory_order_acquire) > mask_) {
+		std::this_thread::yield();
+	}
+
+	ring_[head & mask_] = event;
+	head_.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * Body of the writer thread. Encodes every available event into a buffer and writes
+ * it in one call, then sleeps briefly when the ring is empty.
+ */
+void EventLog::WriteLoop() {
+	vector<char> buffer;
+
+	while (true) {
+		// Read the flag first so events recorded before shutdown are still written
+		bool running = running_;
+
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		size_t head = head_.load(std::memory_order_acquire);
+
+		if (head == tail) {
+			if (!running) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		buffer.resize((head - tail) * kRecordSize);
+		for (size_t i = tail; i != head; i++) {
+			EncodeEvent(ring_[i & mask_], &buffer[(i - tail) * kRecordSize]);
+		}
+		tail_.store(head, std::memory_order_release);
+
+		if (file_) {
+			file_.write(buffer.data(), buffer.size());
+		}
+	}
+
+	file_.flush();
+}
+
+/**
+ * Packs an event into a record without any padding. The fields are copied as they
+ * are stored in memory, which is little-endian on every platform we build for.
+ *
+ * @param event the event to encode
+ * @param record the kRecordSize bytes to write the record into
+ */
+void EventLog::EncodeEvent(const CollisionEvent &event, char *record) {
+	uint8_t flags = event.elastic ? 1 : 0;
+
+	std::memcpy(record, &event.time, 8);
+	std::memcpy(record + 8, &event.body1_id, 4);
+	std::memcpy(record + 12, &event.body2_id, 4);
+	std::memcpy(record + 16, &event.body1_mass, 8);
+	std::memcpy(record + 24, &event.body2_mass, 8);
+	std::memcpy(record + 32, &event.body1_position.x, 12);
+	std::memcpy(record + 44, &event.body2_position.x, 12);
+	std::memcpy(record + 56, &event.relative_velocity.x, 12);
+	std::memcpy(record + 68, &flags, 1);
+}
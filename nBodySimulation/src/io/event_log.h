@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ofVec3f.h"
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * A single collision between two bodies. Masses, positions and the relative velocity
+ * are the values from just before the collision was resolved.
+ */
+struct CollisionEvent {
+	double time;
+	uint32_t body1_id;
+	uint32_t body2_id;
+	double body1_mass;
+	double body2_mass;
+	ofVec3f body1_position;
+	ofVec3f body2_position;
+	ofVec3f relative_velocity;
+	bool elastic;
+};
+
+/**
+ * Records collision and merger events to a compact binary file.
+ *
+ * Events are pushed by the simulation into a single-producer, single-consumer ring
+ * buffer, and a background thread drains the ring and writes the events to disk. The
+ * simulation only waits if the ring is completely full, so no event is ever dropped.
+ *
+ * File layout (little-endian):
+ *   header: "NBEV", uint32 version, uint32 record size
+ *   record: float64 time, uint32 id1, uint32 id2, float64 mass1, float64 mass2,
+ *           float32[3] position1, float32[3] position2, float32[3] relative velocity,
+ *           uint8 flags (bit 0 set for elastic collisions)
+ */
+class EventLog {
+public:
+	static const uint32_t kVersion = 1;
+	static const uint32_t kRecordSize = 69;
+	// Number of events the ring can hold, must be a power of two
+	static const size_t kDefaultCapacity = 1 << 14;
+
+	EventLog(const string &path, bool append = false, size_t capacity = kDefaultCapacity);
+	~EventLog();
+
+	bool IsOpen() const;
+
+	// Called from the simulation thread only
+	void Record(const CollisionEvent &event);
+
+private:
+	void WriteLoop();
+	static void EncodeEvent(const CollisionEvent &event, char *record);
+
+	std::ofstream file_;
+
+	// Ring storage. head_ is only written by Record and tail_ by the writer thread
+	vector<CollisionEvent> ring_;
+	size_t mask_;
+	std::atomic<size_t> head_;
+	std::atomic<size_t> tail_;
+
+	std::atomic<bool> running_;
+	std::thread writer_;
+};
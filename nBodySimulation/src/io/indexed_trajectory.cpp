@@ -0,0 +1,283 @@
+#include "indexed_trajectory.h"
+
+#include <cmath>
+#include <cstring>
+
+// Size of the header, of an index entry and of the footer, in bytes
+static const size_t kHeaderSize = 8;
+static const size_t kEntrySize = 32;
+static const size_t kFooterSize = 24;
+
+static_assert(sizeof(TrajectoryIndexEntry) == kEntrySize, "index entries must be packed");
+
+/**
+ * Returns the size of the columns of a frame, including the padding after them.
+ */
+static uint64_t CalculateFrameSize(uint64_t count) {
+	uint64_t size = count * (2 * sizeof(ofVec3f) + sizeof(double) + sizeof(uint32_t));
+	return (size + 7) / 8 * 8;
+}
+
+/**
+ * Opens the output file and writes the header.
+ *
+ * @param path the file the frames are written to, replaced if it already exists
+ */
+IndexedFrameSink::IndexedFrameSink(const string &path)
+	: file_(path, std::ios::binary | std::ios::trunc), offset_(kHeaderSize) {
+	uint32_t version = kVersion;
+	file_.write("NBTI", 4);
+	file_.write(reinterpret_cast<const char *>(&version), sizeof(version));
+}
+
+bool IndexedFrameSink::IsOpen() const {
+	return file_.is_open();
+}
+
+/**
+ * Appends a frame to the file and adds it to the index.
+ */
+bool IndexedFrameSink::WriteFrame(const TrajectoryFrame &frame) {
+	uint64_t count = frame.positions.size();
+	TrajectoryIndexEntry entry = { frame.step, frame.time, count, offset_ + kEntrySize };
+
+	uint64_t padding = 0;
+	uint64_t columns_size = count * (2 * sizeof(ofVec3f) + sizeof(double) + sizeof(uint32_t));
+
+	file_.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+	file_.write(reinterpret_cast<const char *>(frame.positions.data()), count * sizeof(ofVec3f));
+	file_.write(reinterpret_cast<const char *>(frame.velocities.data()), count * sizeof(ofVec3f));
+	file_.write(reinterpret_cast<const char *>(frame.masses.data()), count * sizeof(double));
+	file_.write(reinterpret_cast<const char *>(frame.ids.data()), count * sizeof(uint32_t));
+	file_.write(reinterpret_cast<const char *>(&padding), CalculateFrameSize(count) - columns_size);
+
+	offset_ = entry.offset + CalculateFrameSize(count);
+	index_.push_back(entry);
+	return file_.good();
+}
+
+/**
+ * Writes the index and the footer after the last frame.
+ */
+bool IndexedFrameSink::Finish() {
+	uint64_t index_offset = offset_;
+	uint64_t frame_count = index_.size();
+	uint32_t version = kVersion;
+
+	file_.write(reinterpret_cast<const char *>(index_.data()), frame_count * kEntrySize);
+	file_.write(reinterpret_cast<const char *>(&index_offset), sizeof(index_offset));
+	file_.write(reinterpret_cast<const char *>(&frame_count), sizeof(frame_count));
+	file_.write("NBTI", 4);
+	file_.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	file_.flush();
+	return file_.good();
+}
+
+/**
+ * Maps an indexed trajectory and loads its index. If the file has no index because it
+ * was never finished, the index is rebuilt from the frames that were written completely.
+ *
+ * @param path the path of the file
+ * @return false if the file is missing or is not an indexed trajectory of this version
+ */
+bool IndexedTrajectoryReader::Open(const string &path) {
+	Close();
+	if (!file_.Open(path, false) || file_.GetSize() < kHeaderSize) {
+		Close();
+		return false;
+	}
+
+	uint32_t version;
+	std::memcpy(&version, file_.GetData() + 4, sizeof(version));
+	if (std::memcmp(file_.GetData(), "NBTI", 4) != 0 || version != IndexedFrameSink::kVersion) {
+		Close();
+		return false;
+	}
+
+	if (!ReadIndex() && !RebuildIndex()) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void IndexedTrajectoryReader::Close() {
+	file_.Close();
+	index_.clear();
+}
+
+size_t IndexedTrajectoryReader::CountFrames() const {
+	return index_.size();
+}
+
+const TrajectoryIndexEntry &IndexedTrajectoryReader::GetEntry(size_t frame) const {
+	return index_[frame];
+}
+
+/**
+ * Finds the last frame at or before a simulation time, or the first frame if the time
+ * is before it. Frames recorded at a fixed interval are evenly spaced in time, so the
+ * frame is computed from the time and at most a step or two is needed to correct it.
+ * Uneven frames fall back to a binary search.
+ *
+ * @param time the simulation time to look for
+ * @return the index of the frame, or 0 if there are no frames
+ */
+size_t IndexedTrajectoryReader::FindFrame(double time) const {
+	if (index_.size() < 2 || time <= index_.front().time) {
+		return 0;
+	}
+	if (time >= index_.back().time) {
+		return index_.size() - 1;
+	}
+
+	double spacing = (index_.back().time - index_.front().time) / (index_.size() - 1);
+	double guess = std::floor((time - index_.front().time) / spacing);
+	size_t frame = (size_t)std::fmin(std::fmax(guess, 0.0), (double)(index_.size() - 1));
+
+	// Rounding can put the guess one frame off
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (index_[frame].time > time) {
+			frame--;
+		} else if (frame + 1 < index_.size() && index_[frame + 1].time <= time) {
+			frame++;
+		}
+	}
+	if (index_[frame].time <= time && (frame + 1 == index_.size() || index_[frame + 1].time > time)) {
+		return frame;
+	}
+
+	size_t low = 0;
+	size_t high = index_.size() - 1;
+	while (low < high) {
+		size_t middle = (low + high + 1) / 2;
+		if (index_[middle].time <= time) {
+			low = middle;
+		} else {
+			high = middle - 1;
+		}
+	}
+	return low;
+}
+
+ArrayView<ofVec3f> IndexedTrajectoryReader::GetPositions(size_t frame) const {
+	const TrajectoryIndexEntry &entry = index_[frame];
+	const char *column = file_.GetData() + entry.offset;
+	return ArrayView<ofVec3f>(reinterpret_cast<const ofVec3f *>(column), (size_t)entry.count);
+}
+
+ArrayView<ofVec3f> IndexedTrajectoryReader::GetVelocities(size_t frame) const {
+	const TrajectoryIndexEntry &entry = index_[frame];
+	const char *column = file_.GetData() + entry.offset + entry.count * sizeof(ofVec3f);
+	return ArrayView<ofVec3f>(reinterpret_cast<const ofVec3f *>(column), (size_t)entry.count);
+}
+
+ArrayView<double> IndexedTrajectoryReader::GetMasses(size_t frame) const {
+	const TrajectoryIndexEntry &entry = index_[frame];
+	const char *column = file_.GetData() + entry.offset + entry.count * 2 * sizeof(ofVec3f);
+	return ArrayView<double>(reinterpret_cast<const double *>(column), (size_t)entry.count);
+}
+
+ArrayView<uint32_t> IndexedTrajectoryReader::GetIds(size_t frame) const {
+	const TrajectoryIndexEntry &entry = index_[frame];
+	const char *column = file_.GetData() + entry.offset
+		+ entry.count * (2 * sizeof(ofVec3f) + sizeof(double));
+	return ArrayView<uint32_t>(reinterpret_cast<const uint32_t *>(column), (size_t)entry.count);
+}
+
+/**
+ * Copies a whole frame out of the file.
+ *
+ * @param frame the index of the frame
+ * @param out receives the frame
+ * @return false if there is no such frame
+ */
+bool IndexedTrajectoryReader::ReadFrame(size_t frame, TrajectoryFrame &out) const {
+	if (frame >= index_.size()) {
+		return false;
+	}
+
+	ArrayView<ofVec3f> positions = GetPositions(frame);
+	ArrayView<ofVec3f> velocities = GetVelocities(frame);
+	ArrayView<double> masses = GetMasses(frame);
+	ArrayView<uint32_t> ids = GetIds(frame);
+
+	out.step = index_[frame].step;
+	out.time = index_[frame].time;
+	out.positions.assign(positions.begin(), positions.end());
+	out.velocities.assign(velocities.begin(), velocities.end());
+	out.masses.assign(masses.begin(), masses.end());
+	out.ids.assign(ids.begin(), ids.end());
+	return true;
+}
+
+/**
+ * Loads the index written by IndexedFrameSink::Finish and checks that every frame it
+ * lists lies within the file.
+ *
+ * @return false if the footer or index is missing or damaged
+ */
+bool IndexedTrajectoryReader::ReadIndex() {
+	size_t size = file_.GetSize();
+	if (size < kHeaderSize + kFooterSize) {
+		return false;
+	}
+
+	const char *footer = file_.GetData() + size - kFooterSize;
+	uint64_t index_offset;
+	uint64_t frame_count;
+	uint32_t version;
+	std::memcpy(&index_offset, footer, sizeof(index_offset));
+	std::memcpy(&frame_count, footer + 8, sizeof(frame_count));
+	std::memcpy(&version, footer + 20, sizeof(version));
+	if (std::memcmp(footer + 16, "NBTI", 4) != 0 || version != IndexedFrameSink::kVersion
+		|| index_offset < kHeaderSize || index_offset > size - kFooterSize
+		|| frame_count != (size - kFooterSize - index_offset) / kEntrySize) {
+		return false;
+	}
+
+	index_.resize((size_t)frame_count);
+	std::memcpy(index_.data(), file_.GetData() + index_offset, (size_t)frame_count * kEntrySize);
+
+	// Frames are stored in order, each ending before the next one starts
+	uint64_t end = kHeaderSize;
+	for (const TrajectoryIndexEntry &entry : index_) {
+		uint64_t max_count = index_offset / (2 * sizeof(ofVec3f) + sizeof(double) + sizeof(uint32_t));
+		if (entry.offset < end + kEntrySize || entry.count > max_count
+			|| entry.offset + CalculateFrameSize(entry.count) > index_offset) {
+			index_.clear();
+			return false;
+		}
+		end = entry.offset + CalculateFrameSize(entry.count);
+	}
+
+	return true;
+}
+
+/**
+ * Rebuilds the index by walking the entries in front of the frames, stopping at the
+ * first frame that was not written completely.
+ *
+ * @return false if not even one complete frame was found
+ */
+bool IndexedTrajectoryReader::RebuildIndex() {
+	index_.clear();
+
+	uint64_t size = file_.GetSize();
+	uint64_t offset = kHeaderSize;
+	while (offset + kEntrySize <= size) {
+		TrajectoryIndexEntry entry;
+		std::memcpy(&entry, file_.GetData() + offset, kEntrySize);
+
+		uint64_t max_count = size / (2 * sizeof(ofVec3f) + sizeof(double) + sizeof(uint32_t));
+		if (entry.offset != offset + kEntrySize || entry.count > max_count
+			|| entry.offset + CalculateFrameSize(entry.count) > size) {
+			break;
+		}
+
+		index_.push_back(entry);
+		offset = entry.offset + CalculateFrameSize(entry.count);
+	}
+
+	return !index_.empty();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "trajectory_writer.h"
+#include "..\engines\array_view.h"
+
+#include "ofVec3f.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * Where a frame of an indexed trajectory is and what it holds.
+ */
+struct TrajectoryIndexEntry {
+	uint64_t step;
+	double time;
+	uint64_t count;
+	// Offset of the first column of the frame from the start of the file
+	uint64_t offset;
+};
+
+/**
+ * Writes frames uncompressed together with an index of where each frame starts, so a
+ * reader can jump straight to any frame instead of reading the file from the start.
+ *
+ * Every frame is stored as columns of a known size, so the offset of any column, and of
+ * any body within a column, follows from the index entry alone. The index is written
+ * after the last frame. Each frame is also preceded by its own entry, which lets a
+ * reader rebuild the index of a file whose writer never finished.
+ *
+ * File layout (little-endian):
+ *   header: "NBTI", uint32 version
+ *   frame: entry, then float32[3] position[count], float32[3] velocity[count],
+ *          float64 mass[count], uint32 id[count], padded to a multiple of 8 bytes
+ *   entry (32 bytes): uint64 step, float64 time, uint64 count, uint64 offset of the columns
+ *   index: entry[frame count]
+ *   footer (24 bytes): uint64 offset of the index, uint64 frame count, "NBTI", uint32 version
+ */
+class IndexedFrameSink : public FrameSink {
+public:
+	static const uint32_t kVersion = 1;
+
+	explicit IndexedFrameSink(const string &path);
+
+	bool IsOpen() const;
+	bool WriteFrame(const TrajectoryFrame &frame) override;
+	bool Finish() override;
+
+private:
+	std::ofstream file_;
+	uint64_t offset_;
+	vector<TrajectoryIndexEntry> index_;
+};
+
+/**
+ * Random access to an indexed trajectory. The file is memory mapped and the columns are
+ * handed out as views into it, so only the parts that are actually looked at are read
+ * from disk.
+ */
+class IndexedTrajectoryReader {
+public:
+	bool Open(const string &path);
+	void Close();
+
+	size_t CountFrames() const;
+	const TrajectoryIndexEntry &GetEntry(size_t frame) const;
+	size_t FindFrame(double time) const;
+
+	// Views of one frame, valid until the file is closed. Use ArrayView::Slice to look
+	// at a range of bodies
+	ArrayView<ofVec3f> GetPositions(size_t frame) const;
+	ArrayView<ofVec3f> GetVelocities(size_t frame) const;
+	ArrayView<double> GetMasses(size_t frame) const;
+	ArrayView<uint32_t> GetIds(size_t frame) const;
+
+	bool ReadFrame(size_t frame, TrajectoryFrame &out) const;
+
+private:
+	bool ReadIndex();
+	bool RebuildIndex();
+
+	MappedFile file_;
+	vector<TrajectoryIndexEntry> index_;
+};
@@ -0,0 +1,127 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : data_(nullptr), size_(0), file_(INVALID_HANDLE_VALUE), mapping_(nullptr) { }
+#else
+MappedFile::MappedFile() : data_(nullptr), size_(0), file_(-1) { }
+#endif
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+/**
+ * Maps a whole file into memory, closing any file that was mapped before.
+ *
+ * @param path the path of the file
+ * @param sequential true if the file will be read front to back, false if it will be
+ *        read in scattered places, which tells the operating system how to page it in
+ * @return true if the file was mapped. Empty files cannot be mapped
+ */
+bool MappedFile::Open(const string &path, bool sequential) {
+	Close();
+
+#ifdef _WIN32
+	file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+						FILE_ATTRIBUTE_NORMAL | (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS),
+						nullptr);
+	if (file_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+		Close();
+		return false;
+	}
+
+	mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_ == nullptr) {
+		Close();
+		return false;
+	}
+
+	data_ = static_cast<const char *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+	if (data_ == nullptr) {
+		Close();
+		return false;
+	}
+	size_ = (size_t)size.QuadPart;
+#else
+	file_ = open(path.c_str(), O_RDONLY);
+	if (file_ < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(file_, &info) != 0 || info.st_size == 0) {
+		Close();
+		return false;
+	}
+
+	void *data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file_, 0);
+	if (data == MAP_FAILED) {
+		Close();
+		return false;
+	}
+
+	madvise(data, (size_t)info.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+	data_ = static_cast<const char *>(data);
+	size_ = (size_t)info.st_size;
+#endif
+
+	return true;
+}
+
+/**
+ * Unmaps the file. Pointers into the file are invalid afterwards.
+ */
+void MappedFile::Close() {
+#ifdef _WIN32
+	if (data_ != nullptr) {
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_ != nullptr) {
+		CloseHandle(mapping_);
+		mapping_ = nullptr;
+	}
+	if (file_ != INVALID_HANDLE_VALUE) {
+		CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (data_ != nullptr) {
+		munmap(const_cast<char *>(data_), size_);
+	}
+	if (file_ >= 0) {
+		close(file_);
+		file_ = -1;
+	}
+#endif
+
+	data_ = nullptr;
+	size_ = 0;
+}
+
+bool MappedFile::IsOpen() const {
+	return data_ != nullptr;
+}
+
+const char *MappedFile::GetData() const {
+	return data_;
+}
+
+size_t MappedFile::GetSize() const {
+	return size_;
+}
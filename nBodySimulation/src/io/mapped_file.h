@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+using std::string;
+
+/**
+ * A file mapped read-only into memory, so its contents can be used in place without
+ * reading them into a buffer first. The operating system pages the file in as it is
+ * accessed.
+ */
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool Open(const string &path, bool sequential = true);
+	void Close();
+
+	bool IsOpen() const;
+	const char *GetData() const;
+	size_t GetSize() const;
+
+private:
+	const char *data_;
+	size_t size_;
+
+#ifdef _WIN32
+	void *file_;
+	void *mapping_;
+#else
+	int file_;
+#endif
+};
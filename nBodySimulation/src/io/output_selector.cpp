@@ -0,0 +1,114 @@
+#include "output_selector.h"
+#include "..\engines\parallel.h"
+
+#include <algorithm>
+
+// Smallest number of bodies worth giving to a thread
+static const int kMinSelectChunk = 16384;
+
+OutputSelector::OutputSelector() : has_mass_range_(false), min_mass_(0), max_mass_(0) { }
+
+/**
+ * Selects the bodies with the given ids, such as tracer particles tagged at the start
+ * of a run. Ids of bodies that were merged away are simply never found.
+ */
+void OutputSelector::AddIds(const vector<uint32_t> &ids) {
+	ids_.insert(ids_.end(), ids.begin(), ids.end());
+	std::sort(ids_.begin(), ids_.end());
+	ids_.erase(std::unique(ids_.begin(), ids_.end()), ids_.end());
+}
+
+/**
+ * Selects the bodies inside an axis-aligned box, edges included.
+ */
+void OutputSelector::AddBox(const ofVec3f &min_corner, const ofVec3f &max_corner) {
+	Box box;
+	box.min_corner = ofVec3f(std::min(min_corner.x, max_corner.x), std::min(min_corner.y, max_corner.y),
+							 std::min(min_corner.z, max_corner.z));
+	box.max_corner = ofVec3f(std::max(min_corner.x, max_corner.x), std::max(min_corner.y, max_corner.y),
+							 std::max(min_corner.z, max_corner.z));
+	boxes_.push_back(box);
+}
+
+/**
+ * Selects the bodies inside a sphere, surface included.
+ */
+void OutputSelector::AddSphere(const ofVec3f &center, float radius) {
+	Sphere sphere;
+	sphere.center = center;
+	sphere.radius_squared = radius * radius;
+	spheres_.push_back(sphere);
+}
+
+/**
+ * Only selects bodies with a mass from min_mass to max_mass, both included.
+ */
+void OutputSelector::SetMassRange(double min_mass, double max_mass) {
+	has_mass_range_ = true;
+	min_mass_ = min_mass;
+	max_mass_ = max_mass;
+}
+
+bool OutputSelector::IsEmpty() const {
+	return ids_.empty() && boxes_.empty() && spheres_.empty() && !has_mass_range_;
+}
+
+/**
+ * Finds the bodies to write. The bodies are checked in parallel, and the result keeps
+ * the order of the engine's arrays for any number of threads.
+ *
+ * @param positions the positions of the bodies
+ * @param masses the masses of the bodies
+ * @param ids the ids of the bodies
+ * @param selected receives the indices of the selected bodies, in increasing order
+ */
+void OutputSelector::Select(ArrayView<ofVec3f> positions, ArrayView<double> masses,
+							ArrayView<uint32_t> ids, vector<uint32_t> &selected) const {
+	thread_selected_.resize(CountWorkerThreads());
+	for (vector<uint32_t> &indices : thread_selected_) {
+		indices.clear();
+	}
+
+	ParallelFor((int)positions.size(), kMinSelectChunk, [&](int thread_idx, int begin, int end) {
+		vector<uint32_t> &indices = thread_selected_[thread_idx];
+		for (int i = begin; i < end; i++) {
+			if (IsSelected(positions[i], masses[i], ids[i])) {
+				indices.push_back((uint32_t)i);
+			}
+		}
+	});
+
+	selected.clear();
+	for (const vector<uint32_t> &indices : thread_selected_) {
+		selected.insert(selected.end(), indices.begin(), indices.end());
+	}
+}
+
+bool OutputSelector::IsSelected(const ofVec3f &position, double mass, uint32_t id) const {
+	if (has_mass_range_ && (mass < min_mass_ || mass > max_mass_)) {
+		return false;
+	}
+	if (ids_.empty() && boxes_.empty() && spheres_.empty()) {
+		return true;
+	}
+
+	if (std::binary_search(ids_.begin(), ids_.end(), id)) {
+		return true;
+	}
+
+	for (const Box &box : boxes_) {
+		if (position.x >= box.min_corner.x && position.x <= box.max_corner.x
+			&& position.y >= box.min_corner.y && position.y <= box.max_corner.y
+			&& position.z >= box.min_corner.z && position.z <= box.max_corner.z) {
+			return true;
+		}
+	}
+
+	for (const Sphere &sphere : spheres_) {
+		if (position.squareDistance(sphere.center) <= sphere.radius_squared) {
+			return true;
+		}
+	}
+
+	return false;
+}
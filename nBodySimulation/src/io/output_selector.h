@@ -0,0 +1,58 @@
+#pragma once
+
+#include "..\engines\array_view.h"
+
+#include "ofVec3f.h"
+
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Picks the bodies worth writing out, so a trajectory can hold only the part of the
+ * simulation a study looks at.
+ *
+ * A body is selected if its id was added, or if it lies inside one of the boxes or
+ * spheres. Without any ids or regions every body matches. The mass range is applied on
+ * top of that, so it can be used on its own or to narrow down a region.
+ */
+class OutputSelector {
+public:
+	OutputSelector();
+
+	void AddIds(const vector<uint32_t> &ids);
+	void AddBox(const ofVec3f &min_corner, const ofVec3f &max_corner);
+	void AddSphere(const ofVec3f &center, float radius);
+	void SetMassRange(double min_mass, double max_mass);
+
+	// Whether nothing was added, in which case every body is selected
+	bool IsEmpty() const;
+
+	void Select(ArrayView<ofVec3f> positions, ArrayView<double> masses,
+				ArrayView<uint32_t> ids, vector<uint32_t> &selected) const;
+
+private:
+	struct Box {
+		ofVec3f min_corner;
+		ofVec3f max_corner;
+	};
+
+	struct Sphere {
+		ofVec3f center;
+		float radius_squared;
+	};
+
+	bool IsSelected(const ofVec3f &position, double mass, uint32_t id) const;
+
+	// Kept sorted for binary search
+	vector<uint32_t> ids_;
+	vector<Box> boxes_;
+	vector<Sphere> spheres_;
+	bool has_mass_range_;
+	double min_mass_;
+	double max_mass_;
+
+	// Indices found by each thread, joined in thread order
+	mutable vector<vector<uint32_t>> thread_selected_;
+};
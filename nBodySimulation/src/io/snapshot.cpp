@@ -0,0 +1,157 @@
+#include "snapshot.h"
+#include "..\engines\physics_engine.h"
+
+#include <cstring>
+#include <fstream>
+
+// The columns are copied straight into the engine's arrays, so the types must match
+static_assert(sizeof(ofVec3f) == 3 * sizeof(float), "positions must be three packed floats");
+static_assert(sizeof(ofColor) == 4, "colors must be four packed bytes");
+
+/**
+ * Checks whether this machine stores numbers little-endian, like the file.
+ */
+static bool IsLittleEndian() {
+	const uint32_t one = 1;
+	return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+/**
+ * Writes the current bodies of a simulation to a snapshot file.
+ *
+ * @param path the path of the file to write
+ * @param simulation the simulation to take the bodies from
+ * @return true if the whole file was written
+ */
+bool SnapshotFile::Write(const string &path, const PhysicsEngine &simulation) {
+	if (!IsLittleEndian()) {
+		return false;
+	}
+
+	ArrayView<ofVec3f> positions = simulation.GetPositions();
+	ArrayView<ofVec3f> velocities = simulation.GetVelocities();
+	ArrayView<double> masses = simulation.GetMasses();
+	ArrayView<ofColor> colors = simulation.GetColors();
+	ArrayView<uint32_t> ids = simulation.GetIds();
+
+	uint32_t version = kVersion;
+	uint64_t count = positions.size();
+	double time = simulation.GetTime();
+	uint64_t reserved = 0;
+
+	std::ofstream out(path, std::ios::binary);
+	out.write("NBSN", 4);
+	out.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char *>(&time), sizeof(time));
+	out.write(reinterpret_cast<const char *>(&reserved), sizeof(reserved));
+	out.write(reinterpret_cast<const char *>(positions.data()), count * sizeof(ofVec3f));
+	out.write(reinterpret_cast<const char *>(velocities.data()), count * sizeof(ofVec3f));
+	out.write(reinterpret_cast<const char *>(masses.data()), count * sizeof(double));
+	out.write(reinterpret_cast<const char *>(colors.data()), count * sizeof(ofColor));
+	out.write(reinterpret_cast<const char *>(ids.data()), count * sizeof(uint32_t));
+
+	return out.good();
+}
+
+SnapshotFile::SnapshotFile() : body_count_(0), time_(0) { }
+
+/**
+ * Maps a snapshot file and checks its header.
+ *
+ * @param path the path of the file to open
+ * @return false if the file is missing, is not a snapshot of this version, or is
+ *         shorter than its header says
+ */
+bool SnapshotFile::Open(const string &path) {
+	Close();
+	if (!IsLittleEndian() || !file_.Open(path) || file_.GetSize() < kHeaderSize) {
+		Close();
+		return false;
+	}
+
+	const char *header = file_.GetData();
+	uint32_t version;
+	uint64_t count;
+	std::memcpy(&version, header + 4, sizeof(version));
+	std::memcpy(&count, header + 8, sizeof(count));
+	std::memcpy(&time_, header + 16, sizeof(time_));
+
+	// Reject counts whose columns could not fit in the file before computing their size
+	uint64_t max_count = file_.GetSize() / (2 * sizeof(ofVec3f) + sizeof(double) + sizeof(ofColor) + sizeof(uint32_t));
+	if (std::memcmp(header, "NBSN", 4) != 0 || version != kVersion
+		|| count > max_count || file_.GetSize() < CalculateFileSize(count)) {
+		Close();
+		return false;
+	}
+
+	body_count_ = (size_t)count;
+	return true;
+}
+
+void SnapshotFile::Close() {
+	file_.Close();
+	body_count_ = 0;
+	time_ = 0;
+}
+
+/**
+ * Adds the bodies of the snapshot to a simulation, after any bodies it already has.
+ *
+ * @param simulation the simulation to add the bodies to
+ * @return false if no snapshot is open
+ */
+bool SnapshotFile::Load(PhysicsEngine &simulation) const {
+	if (!file_.IsOpen()) {
+		return false;
+	}
+
+	simulation.AddBodies(GetPositions(), GetVelocities(), GetMasses(), GetColors());
+	return true;
+}
+
+size_t SnapshotFile::CountBodies() const {
+	return body_count_;
+}
+
+/**
+ * Returns the simulation time the snapshot was taken at.
+ */
+double SnapshotFile::GetTime() const {
+	return time_;
+}
+
+ArrayView<ofVec3f> SnapshotFile::GetPositions() const {
+	const char *column = file_.GetData() + kHeaderSize;
+	return ArrayView<ofVec3f>(reinterpret_cast<const ofVec3f *>(column), body_count_);
+}
+
+ArrayView<ofVec3f> SnapshotFile::GetVelocities() const {
+	const char *column = file_.GetData() + kHeaderSize + body_count_ * sizeof(ofVec3f);
+	return ArrayView<ofVec3f>(reinterpret_cast<const ofVec3f *>(column), body_count_);
+}
+
+ArrayView<double> SnapshotFile::GetMasses() const {
+	const char *column = file_.GetData() + kHeaderSize + body_count_ * 2 * sizeof(ofVec3f);
+	return ArrayView<double>(reinterpret_cast<const double *>(column), body_count_);
+}
+
+ArrayView<ofColor> SnapshotFile::GetColors() const {
+	const char *column = file_.GetData() + kHeaderSize
+		+ body_count_ * (2 * sizeof(ofVec3f) + sizeof(double));
+	return ArrayView<ofColor>(reinterpret_cast<const ofColor *>(column), body_count_);
+}
+
+ArrayView<uint32_t> SnapshotFile::GetIds() const {
+	const char *column = file_.GetData() + kHeaderSize
+		+ body_count_ * (2 * sizeof(ofVec3f) + sizeof(double) + sizeof(ofColor));
+	return ArrayView<uint32_t>(reinterpret_cast<const uint32_t *>(column), body_count_);
+}
+
+/**
+ * Returns the size of a snapshot file holding the given number of bodies.
+ */
+size_t SnapshotFile::CalculateFileSize(uint64_t body_count) {
+	return kHeaderSize + (size_t)body_count
+		* (2 * sizeof(ofVec3f) + sizeof(double) + sizeof(ofColor) + sizeof(uint32_t));
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "..\engines\array_view.h"
+
+#include "ofVec3f.h"
+#include "ofColor.h"
+
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+class PhysicsEngine;
+
+/**
+ * Binary snapshot of the bodies of a simulation, used for initial conditions that are
+ * too large for setup.xml.
+ *
+ * The file is memory mapped when opened, and every body property is stored as its own
+ * column in the same layout as the engine's arrays. Loading a snapshot is therefore a
+ * straight copy from the mapped file into the engine.
+ *
+ * File layout (little-endian):
+ *   header (32 bytes): "NBSN", uint32 version, uint64 body count, float64 time,
+ *                      uint64 reserved (zero)
+ *   columns: float32[3] position[count], float32[3] velocity[count], float64 mass[count],
+ *            uint8[4] color[count] (r, g, b, a), uint32 id[count]
+ *
+ * Every column starts at a multiple of its element alignment.
+ */
+class SnapshotFile {
+public:
+	static const uint32_t kVersion = 1;
+	static const size_t kHeaderSize = 32;
+
+	static bool Write(const string &path, const PhysicsEngine &simulation);
+
+	SnapshotFile();
+
+	bool Open(const string &path);
+	void Close();
+	bool Load(PhysicsEngine &simulation) const;
+
+	size_t CountBodies() const;
+	double GetTime() const;
+
+	// Views into the mapped file, valid until it is closed
+	ArrayView<ofVec3f> GetPositions() const;
+	ArrayView<ofVec3f> GetVelocities() const;
+	ArrayView<double> GetMasses() const;
+	ArrayView<ofColor> GetColors() const;
+	ArrayView<uint32_t> GetIds() const;
+
+private:
+	static size_t CalculateFileSize(uint64_t body_count);
+
+	MappedFile file_;
+	size_t body_count_;
+	double time_;
+};
@@ -0,0 +1,286 @@
+#include "trajectory_player.h"
+#include "..\engines\parallel.h"
+#include "..\engines\physics_engine.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Smallest number of bodies worth giving to a thread when building a snapshot
+static const int kMinSnapshotChunk = 16384;
+
+TrajectoryPlayer::TrajectoryPlayer()
+	: position_(0), speed_(30), playing_(false), wanted_frame_(0), direction_(1), stopping_(false) {
+}
+
+TrajectoryPlayer::~TrajectoryPlayer() {
+	Close();
+}
+
+/**
+ * Opens a trajectory written by IndexedFrameSink and starts reading ahead from its
+ * first frame.
+ *
+ * @param path the path of the trajectory
+ * @param ids the ids of the bodies the run started with
+ * @param colors the colors of those bodies
+ * @return false if the file is missing, is not an indexed trajectory or has no frames
+ */
+bool TrajectoryPlayer::Open(const string &path, ArrayView<uint32_t> ids, ArrayView<ofColor> colors) {
+	Close();
+	if (!reader_.Open(path)) {
+		return false;
+	}
+	if (reader_.CountFrames() == 0) {
+		reader_.Close();
+		return false;
+	}
+
+	colors_.clear();
+	for (size_t i = 0; i < ids.size() && i < colors.size(); i++) {
+		colors_[ids[i]] = colors[i];
+	}
+
+	position_ = 0;
+	playing_ = false;
+	wanted_frame_ = 0;
+	direction_ = 1;
+	stopping_ = false;
+	loader_ = std::thread(&TrajectoryPlayer::PrefetchLoop, this);
+	return true;
+}
+
+/**
+ * Stops reading ahead and closes the file. Snapshots handed out before are no longer
+ * valid.
+ */
+void TrajectoryPlayer::Close() {
+	if (loader_.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		wanted_changed_.notify_one();
+		loader_.join();
+	}
+
+	cache_.clear();
+	before_.reset();
+	after_.reset();
+	reader_.Close();
+}
+
+size_t TrajectoryPlayer::CountFrames() const {
+	return reader_.CountFrames();
+}
+
+// Frame position of the playhead, from 0 to the index of the last frame
+double TrajectoryPlayer::GetPosition() const {
+	return position_;
+}
+
+/**
+ * Returns the simulation time at the playhead, interpolated between the frames on
+ * either side of it.
+ */
+double TrajectoryPlayer::GetTime() const {
+	if (reader_.CountFrames() == 0) {
+		return 0;
+	}
+
+	size_t frame = (size_t)position_;
+	size_t next = std::min(frame + 1, reader_.CountFrames() - 1);
+	double before = reader_.GetEntry(frame).time;
+	double after = reader_.GetEntry(next).time;
+	return before + (after - before) * (position_ - frame);
+}
+
+bool TrajectoryPlayer::IsPlaying() const {
+	return playing_;
+}
+
+/**
+ * Moves the playhead by the wall time that passed since the last update. Playback
+ * stops at either end of the recording.
+ *
+ * @param seconds the wall time that passed, in seconds
+ */
+void TrajectoryPlayer::Update(double seconds) {
+	if (!playing_ || reader_.CountFrames() == 0) {
+		return;
+	}
+
+	double last = (double)(reader_.CountFrames() - 1);
+	position_ += speed_ * seconds;
+	if (position_ <= 0 || position_ >= last) {
+		position_ = std::max(0.0, std::min(last, position_));
+		playing_ = false;
+	}
+}
+
+/**
+ * Moves the playhead to a frame position. Fractional positions lie between two frames.
+ *
+ * @param position the frame position, clamped to the recording
+ */
+void TrajectoryPlayer::Seek(double position) {
+	if (reader_.CountFrames() == 0) {
+		return;
+	}
+
+	position_ = std::max(0.0, std::min((double)(reader_.CountFrames() - 1), position));
+}
+
+/**
+ * Sets how fast the playhead moves.
+ *
+ * @param frames_per_second the frames played per second of wall time, negative to
+ *        play backwards
+ */
+void TrajectoryPlayer::SetSpeed(double frames_per_second) {
+	speed_ = frames_per_second;
+}
+
+/**
+ * Starts or stops playback. Playback that starts at the end it is moving towards
+ * starts over from the other end.
+ */
+void TrajectoryPlayer::SetPlaying(bool playing) {
+	if (playing && reader_.CountFrames() > 1) {
+		double last = (double)(reader_.CountFrames() - 1);
+		if (speed_ > 0 && position_ >= last) {
+			position_ = 0;
+		} else if (speed_ < 0 && position_ <= 0) {
+			position_ = last;
+		}
+	}
+
+	playing_ = playing;
+}
+
+/**
+ * Gets the two frames on either side of the playhead. The snapshots stay valid until
+ * the next call, and their wall times are left at 0.
+ *
+ * @param before receives the frame at or before the playhead, or nullptr if no file is open
+ * @param after receives the frame after the playhead, the same as before at the last frame
+ * @return how far the playhead is from before to after, from 0 to 1
+ */
+double TrajectoryPlayer::AcquireSnapshots(const BodySnapshot *&before, const BodySnapshot *&after) {
+	before = nullptr;
+	after = nullptr;
+	if (reader_.CountFrames() == 0) {
+		return 0;
+	}
+
+	size_t frame = (size_t)position_;
+	size_t next = std::min(frame + 1, reader_.CountFrames() - 1);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		wanted_frame_ = frame;
+		direction_ = (speed_ < 0) ? -1 : 1;
+	}
+	wanted_changed_.notify_one();
+
+	before_ = GetFrame(frame);
+	after_ = GetFrame(next);
+	before = before_.get();
+	after = after_.get();
+	return position_ - frame;
+}
+
+/**
+ * Returns a frame from the cache, or reads it now if the loader has not got to it.
+ */
+TrajectoryPlayer::SnapshotPtr TrajectoryPlayer::GetFrame(size_t frame) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto cached = cache_.find(frame);
+		if (cached != cache_.end()) {
+			return cached->second;
+		}
+	}
+
+	SnapshotPtr snapshot = LoadFrame(frame);
+	std::lock_guard<std::mutex> lock(mutex_);
+	cache_[frame] = snapshot;
+	return snapshot;
+}
+
+/**
+ * Reads a frame from the file into a new snapshot. The radii follow from the masses
+ * the same way the engine computes them.
+ */
+TrajectoryPlayer::SnapshotPtr TrajectoryPlayer::LoadFrame(size_t frame) const {
+	const TrajectoryIndexEntry &entry = reader_.GetEntry(frame);
+	ArrayView<ofVec3f> positions = reader_.GetPositions(frame);
+	ArrayView<double> masses = reader_.GetMasses(frame);
+	ArrayView<uint32_t> ids = reader_.GetIds(frame);
+
+	std::shared_ptr<BodySnapshot> snapshot = std::make_shared<BodySnapshot>();
+	snapshot->time = entry.time;
+	snapshot->wall_time = 0;
+	snapshot->step = entry.step;
+	snapshot->positions.assign(positions.begin(), positions.end());
+	snapshot->ids.assign(ids.begin(), ids.end());
+	snapshot->radii.resize(ids.size());
+	snapshot->colors.resize(ids.size());
+
+	ParallelFor((int)ids.size(), kMinSnapshotChunk, [&](int /*thread_idx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			snapshot->radii[i] = PhysicsEngine::CalculateRadius(masses[i]);
+
+			auto color = colors_.find(ids[i]);
+			snapshot->colors[i] = (color != colors_.end()) ? color->second : ofColor(255, 255, 255);
+		}
+	});
+
+	return snapshot;
+}
+
+/**
+ * Whether a frame is close enough to the playhead to keep: the frames ahead of it in
+ * the direction of play, and the one behind it.
+ */
+bool TrajectoryPlayer::IsWanted(size_t frame) const {
+	long offset = ((long)frame - (long)wanted_frame_) * direction_;
+	return offset >= -1 && offset <= kPrefetchFrames;
+}
+
+/**
+ * Runs on the loader thread. Reads the nearest missing frame ahead of the playhead,
+ * drops the frames that fell out of range, and sleeps until the playhead moves once
+ * every frame in range is ready.
+ */
+void TrajectoryPlayer::PrefetchLoop() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!stopping_) {
+		for (auto it = cache_.begin(); it != cache_.end();) {
+			it = IsWanted(it->first) ? std::next(it) : cache_.erase(it);
+		}
+
+		long missing = -1;
+		for (int offset = 0; offset <= kPrefetchFrames && missing < 0; offset++) {
+			long frame = (long)wanted_frame_ + offset * direction_;
+			if (frame < 0 || frame >= (long)reader_.CountFrames()) {
+				break;
+			}
+			if (cache_.find(frame) == cache_.end()) {
+				missing = frame;
+			}
+		}
+
+		if (missing < 0) {
+			wanted_changed_.wait(lock);
+			continue;
+		}
+
+		// The file is read without holding the lock, so the viewer is never kept waiting
+		lock.unlock();
+		SnapshotPtr snapshot = LoadFrame((size_t)missing);
+		lock.lock();
+		if (cache_.find(missing) == cache_.end()) {
+			cache_[missing] = snapshot;
+		}
+	}
+}
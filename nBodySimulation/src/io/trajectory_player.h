@@ -0,0 +1,88 @@
+#pragma once
+
+#include "indexed_trajectory.h"
+#include "..\engines\snapshot_ring.h"
+
+#include "ofColor.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+using std::string;
+
+/**
+ * Plays back an indexed trajectory as a stream of snapshots for the viewer, so a
+ * finished run can be reviewed without simulating it again.
+ *
+ * The playhead is a frame position that moves at a speed in frames per second of wall
+ * time. Negative speeds play backwards, and the playhead can be moved anywhere at any
+ * time. The viewer is handed the two frames on either side of the playhead and how far
+ * it is between them, like SimulationThread::AcquireSnapshots.
+ *
+ * A background thread reads the frames ahead of the playhead in the direction of play
+ * and turns them into snapshots, so normal playback never waits for the disk. Only a
+ * few frames around the playhead are kept, so the memory used does not depend on the
+ * length of the recording. A frame that is not ready when it is needed, after a jump,
+ * is read on the calling thread.
+ *
+ * Trajectories do not store colors, so the colors are looked up by body id from the
+ * bodies the run was started with. Bodies without a color are drawn white.
+ */
+class TrajectoryPlayer {
+public:
+	// Frames read ahead of the playhead
+	static const int kPrefetchFrames = 4;
+
+	TrajectoryPlayer();
+	~TrajectoryPlayer();
+
+	bool Open(const string &path, ArrayView<uint32_t> ids, ArrayView<ofColor> colors);
+	void Close();
+
+	size_t CountFrames() const;
+	double GetPosition() const;
+	double GetTime() const;
+	bool IsPlaying() const;
+
+	// Playback controls, called from the viewer thread
+	void Update(double seconds);
+	void Seek(double position);
+	void SetSpeed(double frames_per_second);
+	void SetPlaying(bool playing);
+
+	double AcquireSnapshots(const BodySnapshot *&before, const BodySnapshot *&after);
+
+private:
+	typedef std::shared_ptr<const BodySnapshot> SnapshotPtr;
+
+	SnapshotPtr GetFrame(size_t frame);
+	SnapshotPtr LoadFrame(size_t frame) const;
+	bool IsWanted(size_t frame) const;
+	void PrefetchLoop();
+
+	IndexedTrajectoryReader reader_;
+	std::unordered_map<uint32_t, ofColor> colors_;
+
+	double position_;
+	double speed_;
+	bool playing_;
+
+	// The frames handed out by the last AcquireSnapshots, kept alive until the next
+	SnapshotPtr before_;
+	SnapshotPtr after_;
+
+	// Protects cache_, wanted_frame_, direction_ and stopping_
+	std::mutex mutex_;
+	std::condition_variable wanted_changed_;
+	std::map<size_t, SnapshotPtr> cache_;
+	size_t wanted_frame_;
+	int direction_;
+	bool stopping_;
+	std::thread loader_;
+};
@@ -0,0 +1,207 @@
+#include "trajectory_writer.h"
+#include "output_selector.h"
+#include "..\engines\physics_engine.h"
+
+#include <chrono>
+
+/**
+ * Opens the output file and writes the header.
+ *
+ * @param path the file the frames are written to, replaced if it already exists
+ */
+RawFrameSink::RawFrameSink(const string &path)
+	: file_(path, std::ios::binary | std::ios::trunc) {
+	uint32_t version = kVersion;
+	file_.write("NBTR", 4);
+	file_.write(reinterpret_cast<const char *>(&version), sizeof(version));
+}
+
+bool RawFrameSink::IsOpen() const {
+	return file_.is_open();
+}
+
+/**
+ * Appends a frame to the file.
+ */
+bool RawFrameSink::WriteFrame(const TrajectoryFrame &frame) {
+	uint64_t count = frame.positions.size();
+
+	file_.write(reinterpret_cast<const char *>(&frame.step), sizeof(frame.step));
+	file_.write(reinterpret_cast<const char *>(&frame.time), sizeof(frame.time));
+	file_.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	file_.write(reinterpret_cast<const char *>(frame.positions.data()), count * sizeof(ofVec3f));
+	file_.write(reinterpret_cast<const char *>(frame.velocities.data()), count * sizeof(ofVec3f));
+	file_.write(reinterpret_cast<const char *>(frame.masses.data()), count * sizeof(double));
+	file_.write(reinterpret_cast<const char *>(frame.ids.data()), count * sizeof(uint32_t));
+
+	return file_.good();
+}
+
+bool RawFrameSink::Finish() {
+	file_.flush();
+	return file_.good();
+}
+
+/**
+ * Starts the writer thread.
+ *
+ * @param sink receives the frames, must outlive the writer
+ * @param interval a frame is written for every step that is a multiple of this
+ */
+TrajectoryWriter::TrajectoryWriter(FrameSink *sink, int interval)
+	: sink_(sink), interval_(interval > 0 ? interval : 1), selector_(nullptr), fill_index_(0), write_index_(0),
+	  finishing_(false), failed_(false), frames_written_(0), stall_time_(0) {
+	for (int i = 0; i < kBufferCount; i++) {
+		full_[i] = false;
+	}
+
+	writer_ = std::thread(&TrajectoryWriter::WriteLoop, this);
+}
+
+/**
+ * Writes the frames that are still staged, then stops the writer.
+ */
+TrajectoryWriter::~TrajectoryWriter() {
+	Finish();
+}
+
+/**
+ * Writes only the bodies a selector picks instead of every body.
+ *
+ * @param selector the selector to apply to every captured frame
+ */
+void TrajectoryWriter::SetSelector(const OutputSelector *selector) {
+	selector_ = selector;
+}
+
+/**
+ * Stages the current state of the simulation if the step is one to be written. Only
+ * waits if both staging frames are still waiting for the writer.
+ *
+ * @param simulation the simulation to copy the bodies from
+ * @param step the number of steps taken so far
+ */
+void TrajectoryWriter::Capture(const PhysicsEngine &simulation, uint64_t step) {
+	if (step % interval_ != 0) {
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (finishing_) {
+			return;
+		}
+
+		if (full_[fill_index_]) {
+			auto wait_start = std::chrono::steady_clock::now();
+			frame_empty_.wait(lock, [this] { return !full_[fill_index_]; });
+			stall_time_ = stall_time_ + std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - wait_start).count();
+		}
+	}
+
+	// The frame is not full, so the writer will not touch it until it is handed over
+	TrajectoryFrame &frame = buffers_[fill_index_];
+	ArrayView<ofVec3f> positions = simulation.GetPositions();
+	ArrayView<ofVec3f> velocities = simulation.GetVelocities();
+	ArrayView<double> masses = simulation.GetMasses();
+	ArrayView<uint32_t> ids = simulation.GetIds();
+
+	frame.step = step;
+	frame.time = simulation.GetTime();
+	if (selector_ == nullptr) {
+		frame.positions.assign(positions.begin(), positions.end());
+		frame.velocities.assign(velocities.begin(), velocities.end());
+		frame.masses.assign(masses.begin(), masses.end());
+		frame.ids.assign(ids.begin(), ids.end());
+	} else {
+		selector_->Select(positions, masses, ids, selected_);
+
+		size_t count = selected_.size();
+		frame.positions.resize(count);
+		frame.velocities.resize(count);
+		frame.masses.resize(count);
+		frame.ids.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			uint32_t body = selected_[i];
+			frame.positions[i] = positions[body];
+			frame.velocities[i] = velocities[body];
+			frame.masses[i] = masses[body];
+			frame.ids[i] = ids[body];
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		full_[fill_index_] = true;
+	}
+	frame_full_.notify_one();
+	fill_index_ = (fill_index_ + 1) % kBufferCount;
+}
+
+/**
+ * Waits until every staged frame is written, stops the writer thread and finishes the
+ * sink. Frames captured afterwards are ignored.
+ */
+void TrajectoryWriter::Finish() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (finishing_) {
+			return;
+		}
+		finishing_ = true;
+	}
+	frame_full_.notify_one();
+
+	writer_.join();
+	if (!sink_->Finish()) {
+		failed_ = true;
+	}
+}
+
+/**
+ * Returns true if the sink failed to write a frame.
+ */
+bool TrajectoryWriter::HasFailed() const {
+	return failed_;
+}
+
+uint64_t TrajectoryWriter::CountFramesWritten() const {
+	return frames_written_;
+}
+
+double TrajectoryWriter::GetStallTime() const {
+	return stall_time_;
+}
+
+/**
+ * Body of the writer thread. Takes the staged frames in the order they were filled,
+ * writes them outside the lock and hands them back.
+ */
+void TrajectoryWriter::WriteLoop() {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			frame_full_.wait(lock, [this] { return full_[write_index_] || finishing_; });
+			if (!full_[write_index_]) {
+				return;
+			}
+		}
+
+		// After a failure the frames are still taken, so the simulation never waits forever
+		if (!failed_) {
+			if (sink_->WriteFrame(buffers_[write_index_])) {
+				frames_written_++;
+			} else {
+				failed_ = true;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			full_[write_index_] = false;
+		}
+		frame_empty_.notify_one();
+		write_index_ = (write_index_ + 1) % kBufferCount;
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "ofVec3f.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class OutputSelector;
+class PhysicsEngine;
+
+/**
+ * The state of the bodies after one step, as staged for writing.
+ */
+struct TrajectoryFrame {
+	uint64_t step;
+	double time;
+	vector<ofVec3f> positions;
+	vector<ofVec3f> velocities;
+	vector<double> masses;
+	vector<uint32_t> ids;
+};
+
+/**
+ * Destination of the frames of a TrajectoryWriter. WriteFrame is called on the writer
+ * thread, once for each frame in step order.
+ */
+class FrameSink {
+public:
+	virtual ~FrameSink() { }
+
+	// Returns false if the frame could not be written
+	virtual bool WriteFrame(const TrajectoryFrame &frame) = 0;
+	// Called after the last frame, returns false if the output is incomplete
+	virtual bool Finish() { return true; }
+};
+
+/**
+ * Writes frames uncompressed, one after the other.
+ *
+ * File layout (little-endian):
+ *   header: "NBTR", uint32 version
+ *   frame: uint64 step, float64 time, uint64 count, float32[3] position[count],
+ *          float32[3] velocity[count], float64 mass[count], uint32 id[count]
+ */
+class RawFrameSink : public FrameSink {
+public:
+	static const uint32_t kVersion = 1;
+
+	explicit RawFrameSink(const string &path);
+
+	bool IsOpen() const;
+	bool WriteFrame(const TrajectoryFrame &frame) override;
+	bool Finish() override;
+
+private:
+	std::ofstream file_;
+};
+
+/**
+ * Writes the state of the simulation every few steps without slowing the steps down.
+ *
+ * The simulation thread only copies the bodies into one of two staging frames and
+ * carries on. A background thread hands the full frames to a FrameSink, which encodes
+ * and writes them. While the writer works on one frame the simulation can fill the
+ * other. If the writer falls so far behind that both frames are full, the simulation
+ * waits for it rather than dropping frames or using more memory.
+ *
+ * Given an OutputSelector, only the selected bodies are copied into each frame. A
+ * second writer with a selector and a shorter interval can then follow a region or a
+ * set of tracers closely while the first writes every body now and then.
+ */
+class TrajectoryWriter {
+public:
+	TrajectoryWriter(FrameSink *sink, int interval);
+	~TrajectoryWriter();
+
+	// Must be called before the first capture, the selector must outlive the writer
+	void SetSelector(const OutputSelector *selector);
+
+	// Called from the simulation thread after every step
+	void Capture(const PhysicsEngine &simulation, uint64_t step);
+	void Finish();
+
+	bool HasFailed() const;
+	uint64_t CountFramesWritten() const;
+	// Total time the simulation waited for the writer, in seconds
+	double GetStallTime() const;
+
+private:
+	static const int kBufferCount = 2;
+
+	void WriteLoop();
+
+	FrameSink *sink_;
+	int interval_;
+
+	// Picks the bodies copied into a frame, nullptr to copy every body
+	const OutputSelector *selector_;
+	vector<uint32_t> selected_;
+
+	// Staging frames, filled in turn by Capture and emptied in turn by the writer
+	TrajectoryFrame buffers_[kBufferCount];
+	bool full_[kBufferCount];
+	int fill_index_;
+	int write_index_;
+
+	// Protects full_ and finishing_
+	std::mutex mutex_;
+	std::condition_variable frame_full_;
+	std::condition_variable frame_empty_;
+	bool finishing_;
+
+	std::atomic<bool> failed_;
+	std::atomic<uint64_t> frames_written_;
+	std::atomic<double> stall_time_;
+	std::thread writer_;
+};
@@ -1,8 +1,18 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "headless.h"
 
 //========================================================================
-int main( ){
+int main(int argc, char *argv[]){
+	// Batch jobs render straight to image files without opening a window
+	if (HeadlessOptions::IsHeadless(argc, argv)) {
+		HeadlessOptions options;
+		if (!HeadlessOptions::Parse(argc, argv, options)) {
+			return 1;
+		}
+		return RunHeadless(options);
+	}
+
 	ofSetupOpenGL(1024,768,OF_WINDOW);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
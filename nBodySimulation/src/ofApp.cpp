@@ -2,7 +2,16 @@
 #include "engines\few_body.h"
 #include "sphere.h"
 
+#include <unordered_map>
+
 const string ofApp::kXmlFileName = "setup.xml";
+const string ofApp::kEventLogFileName = "events.bin";
+const string ofApp::kLineageFileName = "lineage.bin";
+const string ofApp::kSnapshotFileName = "setup.nbs";
+const string ofApp::kCsvFileName = "setup.csv";
+const string ofApp::kTrajectoryFileName = "trajectory.nbti";
+const string ofApp::kCompressedTrajectoryFileName = "trajectory.nbtz";
+const string ofApp::kCheckpointFileName = "checkpoint.bin";
 
 /**
  * Called at the start of the application. Sets up the
@@ -13,20 +22,38 @@ void ofApp::setup() {
 
 	ofSetFullscreen(false);
 	simulation_ = new FewBodyEngine();
+	simulation_thread_ = nullptr;
+	event_log_ = nullptr;
+	trajectory_sink_ = nullptr;
+	trajectory_writer_ = nullptr;
+	displayed_snapshot_ = nullptr;
+
+	// Without a recording in this session, a compressed one left by an earlier session
+	// may be the newer one, so the uncompressed one is only trusted on its own
+	last_recording_ = ofFile::doesFileExist(kCompressedTrajectoryFileName)
+		? kCompressedTrajectoryFileName : kTrajectoryFileName;
 
 	SetupGui();
 	SetupLights();
 
 	ofSetBackgroundColor(20, 20, 20);
 	camera_.setDistance(500);
+	body_renderer_.Setup();
+	low_poly_sphere_.set(1, 4);
+	point_mesh_.setMode(OF_PRIMITIVE_POINTS);
 
-	// Get the initial conditions from the XML file
+	// Get the initial conditions from the snapshot if there is one, then the CSV file,
+	// otherwise the XML file
 	xml_ = new XmlHelper(kXmlFileName);
-	ReadXml();
+	if (!ReadSnapshot() && !ReadCsv()) {
+		ReadXml();
+	}
 }
 
 /**
- * Main control loop. Updates depending on the current application state
+ * Main control loop. Updates depending on the current application state. The
+ * simulation itself runs on its own thread, so this only passes on the pause
+ * state and picks up the latest positions.
  */
 void ofApp::update() {
 	switch (state_) {
@@ -34,16 +61,22 @@ void ofApp::update() {
 		// Toggle pause state if button is clicked
 		if (pause_button_) {
 			state_ = PAUSED;
+			simulation_thread_->Pause();
 		}
 
-		simulation_->update();
+		speed_label_ = ofToString(simulation_thread_->GetSpeedRatio(), 2) + "x real time";
 		break;
 
 	case PAUSED:
 		if (!pause_button_) {
 			state_ = RUNNING;
+			simulation_thread_->Resume();
 		}
 		break;
+
+	case REPLAY:
+		UpdateReplay();
+		break;
 	}
 
 	// Always update the body position in case of stepping
@@ -64,9 +97,14 @@ void ofApp::draw() {
 
 	case RUNNING:
 	case PAUSED:
-		camera_.begin();
-		DrawSimulationBodies();
-		camera_.end();
+	case REPLAY:
+		if (UseDensityMap()) {
+			DrawDensityMap();
+		} else {
+			camera_.begin();
+			DrawSimulationBodies();
+			camera_.end();
+		}
 		break;
 	}
 
@@ -80,7 +118,20 @@ void ofApp::draw() {
  * Cleans up memory before exiting.
  */
 void ofApp::exit() {
+	// The engine must not be touched while its thread is running
+	delete simulation_thread_;
+	simulation_thread_ = nullptr;
+	displayed_snapshot_ = nullptr;
+
+	if (state_ == RUNNING || state_ == PAUSED) {
+		SaveLineage();
+		SaveCheckpoint();
+	}
+	StopRecording();
+	player_.Close();
+
 	delete simulation_;
+	delete event_log_;
 	delete xml_;
 }
 
@@ -152,10 +203,17 @@ void ofApp::SetupGui() {
 
 	// Gui for running screen
 	run_button_.addListener(this, &ofApp::RunSimulation);
+	resume_button_.addListener(this, &ofApp::ResumeSimulation);
+	replay_button_.addListener(this, &ofApp::StartReplay);
 
 	run_gui_.setup("run");
 	run_gui_.add(elastic_button_.setup("elastic collisions", false));
+	run_gui_.add(record_button_.setup("record trajectory", false));
+	run_gui_.add(record_interval_slider_.setup("record every n steps", 10, 1, 1000));
+	run_gui_.add(compress_button_.setup("compress trajectory", false));
 	run_gui_.add(run_button_.setup("start simulation"));
+	run_gui_.add(resume_button_.setup("resume last run"));
+	run_gui_.add(replay_button_.setup("replay last recording"));
 	run_gui_.setPosition(setup_gui_.getWidth() + 20, 10);
 
 	// Gui for paused screen
@@ -165,28 +223,78 @@ void ofApp::SetupGui() {
 	pause_gui_.setup("pause");
 	pause_gui_.add(pause_button_.setup("pause", false));
 	pause_gui_.add(return_button_.setup("return", false));
+	pause_gui_.add(instanced_button_.setup("instanced rendering", false));
+	pause_gui_.add(density_button_.setup("density map", false));
+	pause_gui_.add(trails_button_.setup("trails", false));
+	pause_gui_.add(speed_slider_.setup("speed (0 = max)", 0, 0, 100));
+	pause_gui_.add(budget_slider_.setup("frame budget (ms)", 16, 1, 100));
+	pause_gui_.add(speed_label_.setup("speed", ""));
+	speed_slider_.addListener(this, &ofApp::SetSpeed);
+	budget_slider_.addListener(this, &ofApp::SetFrameBudget);
 
 	simulation_gui_.setup("simulation");
 	simulation_gui_.add(step_slider_.setup("step amount", 1, 0.01, 10));
 	simulation_gui_.add(step_button_.setup("step"));
 	simulation_gui_.setPosition(10, pause_gui_.getHeight() + 20);
-	
+
+	// Gui for replay screen
+	replay_return_button_.addListener(this, &ofApp::Return);
+
+	replay_gui_.setup("replay");
+	replay_gui_.add(replay_play_button_.setup("play", false));
+	replay_gui_.add(replay_speed_slider_.setup("frames per second", 30, -120, 120));
+	replay_gui_.add(replay_position_slider_.setup("position", 0, 0, 1));
+	replay_gui_.add(replay_return_button_.setup("return"));
+	replay_gui_.add(replay_time_label_.setup("time", ""));
+	replay_position_slider_.addListener(this, &ofApp::SeekReplay);
 }
 
 /**
  * Reverts a running simulation to its setup state.
  */
 void ofApp::Return() {
+	// A replay never touched the engine, so the setup bodies are still there
+	if (state_ == REPLAY) {
+		state_ = SETUP;
+		ofSetBackgroundColor(20, 20, 20);
+		player_.Close();
+		displayed_snapshot_ = nullptr;
+		sphere_ids_.clear();
+		body_changes_.clear();
+		trails_.Clear();
+		BuildSetupSpheres();
+		return;
+	}
+
 	// Reset the state
 	state_ = SETUP;
 	ofSetBackgroundColor(20, 20, 20);
 
+	// Stop the simulation before touching the engine
+	delete simulation_thread_;
+	simulation_thread_ = nullptr;
+	displayed_snapshot_ = nullptr;
+
+	// Keep the merge history and the state of the run that is being thrown away
+	SaveLineage();
+	SaveCheckpoint();
+	StopRecording();
+
 	// Clear the simulation and load the initial conditions from the XML
 	body_spheres_.clear();
+	sphere_ids_.clear();
+	body_changes_.clear();
+	trails_.Clear();
 	delete simulation_;
 	simulation_ = new FewBodyEngine();
 
-	ReadXml();
+	// Finish writing the log of the previous run
+	delete event_log_;
+	event_log_ = nullptr;
+
+	if (!ReadSnapshot() && !ReadCsv()) {
+		ReadXml();
+	}
 }
 
 /**
@@ -200,11 +308,25 @@ void ofApp::Return() {
  * RUNNING:
  *   - BACKSPACE - return to setup
  *   - p - pause
+ *   - i - toggle instanced rendering
+ *   - d - toggle density map
+ *   - t - toggle trails
  *   - ESC - quit
  * PAUSED:
  *   - BACKSPACE - return to setup
  *   - p - continue
  *   - s - step
+ *   - i - toggle instanced rendering
+ *   - d - toggle density map
+ *   - t - toggle trails
+ *   - ESC - quit
+ * REPLAY:
+ *   - BACKSPACE - return to setup
+ *   - p - play or pause
+ *   - LEFT / RIGHT - previous or next frame
+ *   - i - toggle instanced rendering
+ *   - d - toggle density map
+ *   - t - toggle trails
  *   - ESC - quit
  *
  * @param key the key that is pressed
@@ -226,11 +348,25 @@ void ofApp::keyPressed(int key) {
 		break;
 
 	case 'p':
-		if (state_ != SETUP) {
+		if (state_ == REPLAY) {
+			replay_play_button_ = !replay_play_button_;
+		} else if (state_ != SETUP) {
 			pause_button_ = (state_ == RUNNING) ? true : false;
 		}
 		break;
 
+	case OF_KEY_LEFT:
+		if (state_ == REPLAY) {
+			player_.Seek(std::ceil(player_.GetPosition()) - 1);
+		}
+		break;
+
+	case OF_KEY_RIGHT:
+		if (state_ == REPLAY) {
+			player_.Seek(std::floor(player_.GetPosition()) + 1);
+		}
+		break;
+
 	case 's':
 		if (state_ == PAUSED) {
 			Step();
@@ -243,6 +379,24 @@ void ofApp::keyPressed(int key) {
 		}
 		break;
 
+	case 'i':
+		if (state_ != SETUP) {
+			instanced_button_ = !instanced_button_;
+		}
+		break;
+
+	case 'd':
+		if (state_ != SETUP) {
+			density_button_ = !density_button_;
+		}
+		break;
+
+	case 't':
+		if (state_ != SETUP) {
+			trails_button_ = !trails_button_;
+		}
+		break;
+
 	case OF_KEY_ESC:
 		exit();
 		std::exit(0);
@@ -253,6 +407,13 @@ void ofApp::keyPressed(int key) {
  * Helper function that draws the bodies during the setup phase.
  */
 void ofApp::DrawSetupBodies() {
+	// Large systems have no spheres, since one sphere per body would not fit on the screen
+	if ((int)body_spheres_.size() != simulation_->CountBodies()) {
+		ofDrawBitmapString(ofToString(simulation_->CountBodies()) + " bodies loaded",
+						   ofGetWidth() * 0.4, ofGetHeight() * 0.6);
+		return;
+	}
+
 	double offset = (double)ofGetWidth() / ((double)body_spheres_.size() + 1);
 	double x = offset;
 	for (ColoredSphere& sp : body_spheres_) {
@@ -290,47 +451,304 @@ void ofApp::DrawGui() {
 		simulation_gui_.draw();
 		pause_gui_.draw();
 		break;
+
+	case REPLAY:
+		replay_gui_.draw();
+		break;
 	}
 
 	DrawInstructions();
 }
 
 /**
- * Helper function that switches the state of the application to running.
+ * Helper function that switches the state of the application to running. Also starts
+ * a new collision log in bin/data/events.bin.
  */
 void ofApp::RunSimulation() {
+	StartSimulation(false);
+}
+
+/**
+ * Starts the simulation thread on the bodies in the engine and switches to running.
+ *
+ * @param resumed whether the engine holds a run restored from a checkpoint, whose
+ *        collisions are added to the log of the earlier part of the run
+ */
+void ofApp::StartSimulation(bool resumed) {
 	simulation_->SetElasticCollisions(elastic_button_);
+
+	// Record the collisions of this run. A new run replaces the log of the previous one
+	event_log_ = new EventLog(ofToDataPath(kEventLogFileName), resumed);
+	simulation_->SetEventLog(event_log_);
+
+	simulation_thread_ = new SimulationThread(simulation_);
+
+	// Recording happens on a background thread, so it does not slow the steps down
+	if (record_button_) {
+		if (compress_button_) {
+			trajectory_sink_ = new CompressedFrameSink(ofToDataPath(kCompressedTrajectoryFileName),
+													   CompressedFrameSink::kDefaultPositionError,
+													   CompressedFrameSink::kDefaultVelocityError);
+		} else {
+			trajectory_sink_ = new IndexedFrameSink(ofToDataPath(kTrajectoryFileName));
+		}
+		last_recording_ = compress_button_ ? kCompressedTrajectoryFileName : kTrajectoryFileName;
+		trajectory_writer_ = new TrajectoryWriter(trajectory_sink_, record_interval_slider_);
+		simulation_thread_->SetTrajectoryWriter(trajectory_writer_);
+	}
+
+	simulation_thread_->SetSpeed(speed_slider_);
+	simulation_thread_->SetFrameBudget(budget_slider_ / 1000);
+	simulation_thread_->Start();
 	state_ = RUNNING;
 	ofSetBackgroundColor(0, 0, 0);
 }
 
 /**
- * Draws each body with the correct color.
+ * Continues the run that was saved to bin/data/checkpoint.bin when it was last stopped,
+ * in place of the bodies on the setup screen. Stays on the setup screen if there is no
+ * checkpoint. A resumed run numbers its steps on from the checkpoint and adds its
+ * collisions to the log of the earlier part of the run. It records to a new trajectory,
+ * so it refuses to start if recording would overwrite the trajectory of the earlier
+ * part of the run.
+ */
+void ofApp::ResumeSimulation() {
+	// Recording would start the trajectory of the first part of the run over
+	const string &trajectory_file = compress_button_ ? kCompressedTrajectoryFileName : kTrajectoryFileName;
+	if (record_button_ && ofFile::doesFileExist(trajectory_file)) {
+		ofLogError() << "Not resuming, recording would overwrite " << trajectory_file
+					 << ". Move it away or turn recording off first";
+		return;
+	}
+
+	if (!CheckpointFile::Read(ofToDataPath(kCheckpointFileName), *simulation_)) {
+		ofLogError() << "Could not load " << kCheckpointFileName;
+		return;
+	}
+
+	// The checkpoint decides how collisions are handled, not the toggle
+	elastic_button_ = simulation_->HasElasticCollisions();
+	body_spheres_.clear();
+	StartSimulation(true);
+}
+
+/**
+ * Plays back the trajectory recorded to bin/data/trajectory.nbti in place of running
+ * the simulation. The colors of the bodies come from the setup screen, so they match
+ * when the recording was made from the same setup. Stays on the setup screen if there
+ * is no recording, or if the last recording was compressed, since only uncompressed
+ * trajectories can be played back.
+ */
+void ofApp::StartReplay() {
+	// An older uncompressed trajectory would be from a different run
+	if (last_recording_ != kTrajectoryFileName) {
+		ofLogError() << "Cannot replay " << last_recording_
+					 << ", only recordings made with compress trajectory off can be replayed";
+		return;
+	}
+
+	if (!player_.Open(ofToDataPath(kTrajectoryFileName), simulation_->GetIds(), simulation_->GetColors())) {
+		ofLogError() << "Could not load " << kTrajectoryFileName;
+		return;
+	}
+
+	body_spheres_.clear();
+	sphere_ids_.clear();
+	body_changes_.clear();
+	replay_play_button_ = true;
+	replay_position_slider_ = 0;
+	state_ = REPLAY;
+	ofSetBackgroundColor(0, 0, 0);
+}
+
+/**
+ * Passes the replay controls on to the player and moves the playhead on by the time
+ * the last frame took. The controls follow the player, which stops at either end.
+ */
+void ofApp::UpdateReplay() {
+	player_.SetSpeed(replay_speed_slider_);
+	if ((bool)replay_play_button_ != player_.IsPlaying()) {
+		player_.SetPlaying(replay_play_button_);
+	}
+	player_.Update(ofGetLastFrameTime());
+
+	replay_play_button_ = player_.IsPlaying();
+	if (player_.CountFrames() > 1) {
+		replay_position_slider_ = player_.GetPosition() / (player_.CountFrames() - 1);
+	}
+	replay_time_label_ = ofToString(player_.GetTime(), 2) + " s, frame "
+		+ ofToString((size_t)player_.GetPosition() + 1) + " of " + ofToString(player_.CountFrames());
+}
+
+/**
+ * Moves the replay to a point in the recording.
+ *
+ * @param fraction how far into the recording, from 0 to 1
+ */
+void ofApp::SeekReplay(double &fraction) {
+	if (state_ == REPLAY && player_.CountFrames() > 1) {
+		player_.Seek(fraction * (player_.CountFrames() - 1));
+	}
+}
+
+/**
+ * Draws each body with the correct color. Bodies outside the view are skipped, and
+ * bodies that are small on screen are drawn as coarse spheres or points.
  */
 void ofApp::DrawSimulationBodies() {
-	for (ColoredSphere& sp : body_spheres_) {
+	if (displayed_snapshot_ == nullptr) {
+		return;
+	}
+
+	const vector<double> &radii = displayed_snapshot_->radii;
+	ViewFrustum frustum(camera_.getGlobalPosition(), camera_.getLookAtDir(), camera_.getUpDir(),
+						camera_.getFov(), ofGetViewportWidth(), ofGetViewportHeight(),
+						camera_.getFarClip());
+	culler_.Classify(frustum, ArrayView<ofVec3f>(display_positions_.data(), display_positions_.size()),
+					 ArrayView<double>(radii.data(), radii.size()));
+
+	if (trails_button_) {
+		trails_.Draw();
+	}
+
+	if (UseInstancedRendering()) {
+		body_renderer_.Draw(display_positions_, radii, displayed_snapshot_->colors, culler_);
+		return;
+	}
+
+	// The spheres are only missing for the frame in which the renderer was switched
+	if (body_spheres_.size() != display_positions_.size()) {
+		return;
+	}
+
+	for (int i : culler_.GetBodies(SPHERE)) {
 		// Push a new style for each color
 		ofPushStyle();
-		ofSetColor(sp.color);
-		sp.sphere.drawWireframe();
+		ofSetColor(body_spheres_[i].color);
+		body_spheres_[i].sphere.drawWireframe();
+		ofPopStyle();
+	}
+
+	for (int i : culler_.GetBodies(LOW_POLY)) {
+		ofPushStyle();
+		ofSetColor(body_spheres_[i].color);
+		ofPushMatrix();
+		ofTranslate(display_positions_[i]);
+		ofScale(radii[i], radii[i], radii[i]);
+		low_poly_sphere_.drawWireframe();
+		ofPopMatrix();
 		ofPopStyle();
 	}
+
+	// All points go into one mesh so they are drawn in a single call
+	point_mesh_.clearVertices();
+	point_mesh_.clearColors();
+	for (int i : culler_.GetBodies(POINT)) {
+		point_mesh_.addVertex(display_positions_[i]);
+		point_mesh_.addColor(body_spheres_[i].color);
+	}
+	point_mesh_.draw();
+}
+
+/**
+ * Draws the density of the bodies as seen through the camera, filling the screen.
+ */
+void ofApp::DrawDensityMap() {
+	if (displayed_snapshot_ == nullptr) {
+		return;
+	}
+
+	SplatCamera camera;
+	camera.position = camera_.getGlobalPosition();
+	camera.target = camera.position + camera_.getLookAtDir();
+	camera.up = camera_.getUpDir();
+	camera.fov = camera_.getFov();
+	camera.near_clip = 0.1f;
+
+	int width = ofGetWidth() / kDensityCellPixels;
+	int height = ofGetHeight() / kDensityCellPixels;
+	density_map_.Build(camera, width, height,
+					   ArrayView<ofVec3f>(display_positions_.data(), display_positions_.size()));
+
+	if (!density_texture_.isAllocated() || density_texture_.getWidth() != width
+		|| density_texture_.getHeight() != height) {
+		density_texture_.allocate(width, height, GL_RGB);
+		density_texture_.setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	}
+	density_texture_.loadData(density_map_.GetPixels().data(), width, height, GL_RGB);
+
+	ofPushStyle();
+	ofDisableLighting();
+	ofDisableDepthTest();
+	ofSetColor(255);
+	density_texture_.draw(0, 0, ofGetWidth(), ofGetHeight());
+	ofPopStyle();
 }
 
 /**
- * Updates the local body list with the positions from the simulation.
+ * Updates the local body list with the positions from the simulation, interpolated
+ * between the two snapshots around the display time so the motion stays smooth.
  * Also adds rotation to the bodies to make them look more realistic.
  */
 void ofApp::UpdateSimulationBodies() {
-	// If there was an inelastic collision and the number of bodies changed, update the entire list
-	if (simulation_->CountBodies() != body_spheres_.size()) {
-		body_spheres_ = ColoredSphere::ParseBodies(simulation_);
+	const BodySnapshot *before;
+	const BodySnapshot *after;
+	float fraction;
+	if (state_ == REPLAY) {
+		fraction = (float)player_.AcquireSnapshots(before, after);
+	} else if (simulation_thread_ != nullptr) {
+		fraction = simulation_thread_->AcquireSnapshots(before, after, body_changes_);
+	} else {
+		// The setup screen arranges the bodies itself
+		return;
+	}
+	if (before == nullptr) {
+		return;
+	}
+
+	// Bodies can only be interpolated if no collision changed them in between
+	bool interpolate = (before != after && before->ids == after->ids);
+
+	displayed_snapshot_ = before;
+	display_positions_.resize(before->positions.size());
+	for (size_t i = 0; i < display_positions_.size(); i++) {
+		if (interpolate) {
+			display_positions_[i] = before->positions[i].getInterpolated(after->positions[i], fraction);
+		} else {
+			display_positions_[i] = before->positions[i];
+		}
+	}
+
+	// Trails are kept by body id, so they follow the bodies through every renderer
+	if (trails_button_) {
+		trails_.Update(before->ids, display_positions_, before->colors);
+	} else {
+		trails_.Clear();
+	}
+
+	// The instanced renderer and the density map draw straight from the snapshot, so the
+	// spheres are dropped and rebuilt from scratch if the sphere renderer is used again
+	if (UseInstancedRendering() || UseDensityMap()) {
+		body_spheres_.clear();
+		sphere_ids_.clear();
+		body_changes_.clear();
+		return;
+	}
+
+	// Only the spheres of bodies that were added, removed or merged need to change
+	if (state_ != REPLAY) {
+		ApplyBodyChanges();
+	}
+
+	// Rebuild the entire list when starting, or if the spheres got out of step. Replays
+	// carry no changes, so they rebuild whenever the bodies differ
+	if (sphere_ids_ != before->ids || body_spheres_.size() != sphere_ids_.size()) {
+		body_spheres_ = ColoredSphere::ParseBodies(*before);
+		sphere_ids_ = before->ids;
 	}
 
-	vector<ofVec3f> positions = simulation_->GetBodyPositions();
 	for (int i = 0; i < body_spheres_.size(); i++) {
-		// Set the position of the sphere
-		body_spheres_[i].sphere.setPosition(positions[i]);
+		body_spheres_[i].sphere.setPosition(display_positions_[i]);
 		
 		// Rotate the sphere slightly to aid in the 3d visualization
 		body_spheres_[i].sphere.rotate(ofGetElapsedTimef() * 25, 0.15, 1.0, 0.0);
@@ -338,12 +756,136 @@ void ofApp::UpdateSimulationBodies() {
 }
 
 /**
- * Called when the step button is pressed. Updates the simulation based on the
- * position of the step slider.
+ * Whether the bodies are drawn by the instanced renderer rather than as separate
+ * spheres. Large simulations always use it, smaller ones when it is switched on.
+ *
+ * @return true if the instanced renderer should be used
+ */
+bool ofApp::UseInstancedRendering() {
+	if (instanced_button_) {
+		return true;
+	}
+
+	return displayed_snapshot_ != nullptr && displayed_snapshot_->ids.size() > kMaxSphereBodies;
+}
+
+/**
+ * Whether the density map is drawn instead of the bodies. Runs too large to draw
+ * body by body always use it, others when it is switched on.
+ *
+ * @return true if the density map should be drawn
+ */
+bool ofApp::UseDensityMap() {
+	if (density_button_) {
+		return true;
+	}
+
+	return displayed_snapshot_ != nullptr && displayed_snapshot_->ids.size() > kMaxDrawnBodies;
+}
+
+/**
+ * Updates the spheres for the changes the simulation made to its bodies. Merged
+ * bodies get their new size and color, removed bodies lose their sphere, and new
+ * bodies get a sphere at the end, which keeps the spheres in the same order as
+ * the bodies in the snapshots. Changes to bodies without a sphere are skipped, and
+ * every change is used up, whether it was applied or not.
+ */
+void ofApp::ApplyBodyChanges() {
+	if (body_changes_.empty() || sphere_ids_.size() != body_spheres_.size()) {
+		body_changes_.clear();
+		return;
+	}
+
+	std::unordered_map<uint32_t, size_t> sphere_indices;
+	for (size_t i = 0; i < sphere_ids_.size(); i++) {
+		sphere_indices[sphere_ids_[i]] = i;
+	}
+
+	vector<bool> removed(sphere_ids_.size(), false);
+	for (const BodyChange &change : body_changes_) {
+		switch (change.type) {
+		case BodyChange::ADDED: {
+			ColoredSphere sp;
+			sp.sphere.setRadius(change.radius);
+			sp.color.set(change.color);
+
+			sphere_indices[change.id] = body_spheres_.size();
+			body_spheres_.push_back(sp);
+			sphere_ids_.push_back(change.id);
+			removed.push_back(false);
+			break;
+		}
+
+		case BodyChange::MERGED: {
+			auto survivor = sphere_indices.find(change.id);
+			if (survivor != sphere_indices.end()) {
+				ColoredSphere &sp = body_spheres_[survivor->second];
+				sp.sphere.setRadius(change.radius);
+				sp.color.set(change.color);
+			}
+
+			auto absorbed = sphere_indices.find(change.other_id);
+			if (absorbed != sphere_indices.end()) {
+				removed[absorbed->second] = true;
+			}
+			break;
+		}
+
+		case BodyChange::REMOVED: {
+			auto body = sphere_indices.find(change.id);
+			if (body != sphere_indices.end()) {
+				removed[body->second] = true;
+			}
+			break;
+		}
+		}
+	}
+	body_changes_.clear();
+
+	// Remove the spheres of deleted bodies, keeping the order of the rest
+	size_t kept = 0;
+	for (size_t i = 0; i < sphere_ids_.size(); i++) {
+		if (!removed[i]) {
+			if (kept != i) {
+				body_spheres_[kept] = body_spheres_[i];
+				sphere_ids_[kept] = sphere_ids_[i];
+			}
+			kept++;
+		}
+	}
+	body_spheres_.resize(kept);
+	sphere_ids_.resize(kept);
+}
+
+/**
+ * Called when the step button is pressed. Asks the simulation thread for a number
+ * of steps based on the position of the step slider.
  */
 void ofApp::Step() {
-	for (int i = 0; i < (int)(step_slider_ / 0.01); i++) {
-		simulation_->update();
+	if (simulation_thread_ != nullptr) {
+		simulation_thread_->Step((int)(step_slider_ / 0.01));
+	}
+}
+
+/**
+ * Runs the simulation at the speed set by the slider.
+ *
+ * @param speed simulation seconds per wall second, or 0 for as fast as possible
+ */
+void ofApp::SetSpeed(double &speed) {
+	if (simulation_thread_ != nullptr) {
+		simulation_thread_->SetSpeed(speed);
+	}
+}
+
+/**
+ * Changes how long the simulation thread may step before publishing a snapshot.
+ *
+ * @param milliseconds the frame budget in milliseconds
+ */
+void ofApp::SetFrameBudget(double &milliseconds) {
+	if (simulation_thread_ != nullptr) {
+		simulation_thread_->SetFrameBudget(milliseconds / 1000);
 	}
 }
 
@@ -374,32 +916,127 @@ void ofApp::SetupLights() {
 }
 
 /**
- * Reads initial conditions from the setup.xml file. Uses the ofApp::AddBody function
- * for a cleaner initialization process.
+ * Reads initial conditions from the setup.xml file. The bodies are parsed into arrays
+ * and added to the engine in one call, bypassing the sliders and AddBody, which would
+ * write every body back to the XML file.
  */
 void ofApp::ReadXml() {
 	if (xml_->IsEmpty()) {
 		return;
 	}
 
-	// Stops the AddBody function from creating duplicates
-	xml_->SetReadOnly(true);
-
-	// Loop through each body and get the parameters
+	// Parse every body into arrays first, so the engine can take them all at once
 	int bodies_count = xml_->CountBodies();
+	vector<ofVec3f> positions;
+	vector<ofVec3f> velocities;
+	vector<double> masses;
+	vector<ofColor> colors;
+	positions.reserve(bodies_count);
+	velocities.reserve(bodies_count);
+	masses.reserve(bodies_count);
+	colors.reserve(bodies_count);
+
 	for (int i = 0; i < bodies_count; i++) {
-		// Set the position of the GUI sliders so that AddBody can be called
-		position_slider_ = xml_->GetPosition(i);
-		velocity_slider_ = xml_->GetVelocity(i);
-		mass_slider_ = xml_->GetMass(i);
-		color_slider_ = xml_->GetColor(i);
+		positions.push_back(xml_->GetPosition(i));
+		velocities.push_back(xml_->GetVelocity(i));
+		masses.push_back(xml_->GetMass(i));
+		colors.push_back(xml_->GetColor(i));
+	}
+
+	// The bodies are already in the XML file, so they are not written back to it
+	simulation_->AddBodies(ArrayView<ofVec3f>(positions.data(), positions.size()),
+						   ArrayView<ofVec3f>(velocities.data(), velocities.size()),
+						   ArrayView<double>(masses.data(), masses.size()),
+						   ArrayView<ofColor>(colors.data(), colors.size()));
+	BuildSetupSpheres();
+}
+
+/**
+ * Writes the frames of the trajectory that are still staged and closes the trajectory
+ * file. The simulation thread must already be stopped.
+ */
+void ofApp::StopRecording() {
+	if (trajectory_writer_ == nullptr) {
+		return;
+	}
+
+	trajectory_writer_->Finish();
+	if (trajectory_writer_->HasFailed()) {
+		ofLogError() << "Could not write the trajectory";
+	}
+
+	delete trajectory_writer_;
+	delete trajectory_sink_;
+	trajectory_writer_ = nullptr;
+	trajectory_sink_ = nullptr;
+}
+
+/**
+ * Loads the initial conditions from bin/data/setup.nbs, a binary snapshot that can hold
+ * far more bodies than setup.xml. The bodies are copied straight from the mapped file
+ * into the engine instead of going through AddBody one at a time.
+ *
+ * @return false if there is no valid snapshot, in which case nothing was loaded
+ */
+bool ofApp::ReadSnapshot() {
+	SnapshotFile snapshot;
+	if (!snapshot.Open(ofToDataPath(kSnapshotFileName)) || !snapshot.Load(*simulation_)) {
+		return false;
+	}
 
-		// DRY, reuses AddBody code but prevents XML writing
-		AddBody();
+	BuildSetupSpheres();
+	return true;
+}
+
+/**
+ * Loads the initial conditions from bin/data/setup.csv, a table with one body per line
+ * and a header naming the columns. Large tables are parsed in parallel.
+ *
+ * @return false if there is no valid table, in which case nothing was loaded
+ */
+bool ofApp::ReadCsv() {
+	CsvImporter importer;
+	if (!importer.Load(ofToDataPath(kCsvFileName), *simulation_)) {
+		if (importer.GetBadLine() != 0) {
+			ofLogError() << "Could not read line " << importer.GetBadLine() << " of " << kCsvFileName;
+		}
+		return false;
 	}
 
-	// Restore the writing permissions to the XML reader
-	xml_->SetReadOnly(false);
+	BuildSetupSpheres();
+	return true;
+}
+
+/**
+ * Builds the spheres of the setup screen for every body in one batch. The setup screen
+ * lays the spheres out side by side, so only small systems get them.
+ */
+void ofApp::BuildSetupSpheres() {
+	body_spheres_.clear();
+	if ((size_t)simulation_->CountBodies() <= kMaxSphereBodies) {
+		body_spheres_ = ColoredSphere::ParseBodies(simulation_);
+	}
+}
+
+/**
+ * Writes the merge history of the current run to bin/data/lineage.bin so that the
+ * accretion history of each body can be reconstructed after the run.
+ */
+void ofApp::SaveLineage() {
+	std::ofstream out(ofToDataPath(kLineageFileName), std::ios::binary);
+	if (!simulation_->GetLineage().Write(out)) {
+		ofLogError() << "Could not write " << kLineageFileName;
+	}
+}
+
+/**
+ * Writes the complete state of the current run to bin/data/checkpoint.bin so that it
+ * can be resumed later. The simulation thread must already be stopped.
+ */
+void ofApp::SaveCheckpoint() {
+	if (!CheckpointFile::Write(ofToDataPath(kCheckpointFileName), *simulation_)) {
+		ofLogError() << "Could not write " << kCheckpointFileName;
+	}
 }
 
 /**
@@ -413,11 +1050,25 @@ void ofApp::ReadXml() {
  * RUNNING:
  *   - BACKSPACE - return to setup
  *   - p - pause
+ *   - i - toggle instanced rendering
+ *   - d - toggle density map
+ *   - t - toggle trails
  *   - ESC - quit
  * PAUSED:
  *   - BACKSPACE - return to setup
  *   - p - continue
  *   - s - step
+ *   - i - toggle instanced rendering
+ *   - d - toggle density map
+ *   - t - toggle trails
+ *   - ESC - quit
+ * REPLAY:
+ *   - BACKSPACE - return to setup
+ *   - p - play or pause
+ *   - LEFT / RIGHT - previous or next frame
+ *   - i - toggle instanced rendering
+ *   - d - toggle density map
+ *   - t - toggle trails
  *   - ESC - quit
  */
 void ofApp::DrawInstructions() {
@@ -434,6 +1085,9 @@ void ofApp::DrawInstructions() {
 		instructions = "Keyboard Shortcuts:\n"
 			" * BACKSPACE - return to setup\n"
 			" * p - pause\n"
+			" * i - toggle instanced rendering\n"
+			" * d - toggle density map\n"
+			" * t - toggle trails\n"
 			" * ESC - exit";
 		break;
 	case PAUSED:
@@ -441,6 +1095,19 @@ void ofApp::DrawInstructions() {
 			" * BACKSPACE - return to setup\n"
 			" * p - continue\n"
 			" * s - step\n"
+			" * i - toggle instanced rendering\n"
+			" * d - toggle density map\n"
+			" * t - toggle trails\n"
+			" * ESC - exit";
+		break;
+	case REPLAY:
+		instructions = "Keyboard Shortcuts:\n"
+			" * BACKSPACE - return to setup\n"
+			" * p - play or pause\n"
+			" * LEFT / RIGHT - previous or next frame\n"
+			" * i - toggle instanced rendering\n"
+			" * d - toggle density map\n"
+			" * t - toggle trails\n"
 			" * ESC - exit";
 		break;
 	}
@@ -3,6 +3,19 @@
 #include "ofMain.h"
 #include "ofxGui.h"
 #include "engines\physics_engine.h"
+#include "engines\simulation_thread.h"
+#include "io\checkpoint.h"
+#include "io\compressed_trajectory.h"
+#include "io\csv_importer.h"
+#include "io\event_log.h"
+#include "io\indexed_trajectory.h"
+#include "io\snapshot.h"
+#include "io\trajectory_player.h"
+#include "io\trajectory_writer.h"
+#include "render\culling.h"
+#include "render\density_map.h"
+#include "render\instanced_renderer.h"
+#include "render\trails.h"
 #include "sphere.h"
 #include "xml_helpers.h"
 
@@ -19,18 +32,33 @@ public:
 
 private:
 	static const string kXmlFileName;
+	static const string kEventLogFileName;
+	static const string kLineageFileName;
+	static const string kSnapshotFileName;
+	static const string kCsvFileName;
+	static const string kTrajectoryFileName;
+	static const string kCompressedTrajectoryFileName;
+	static const string kCheckpointFileName;
+	// Above this many bodies, drawing a separate sphere for each one gets too slow
+	static const size_t kMaxSphereBodies = 500;
+	// Above this many bodies, only the density map is drawn
+	static const size_t kMaxDrawnBodies = 100000;
+	// Size of the density map bins on screen, in pixels
+	static const int kDensityCellPixels = 2;
 	/**
 	 * Enumeration to represent the state of the program
 	 * 
 	 * SETUP - the phase where the initial conditions are set
 	 * RUNNING - the simulation is allowed to run at the default rate
 	 * PAUSED - the simulation is frozen and can be stepped through
+	 * REPLAY - a recorded trajectory is played back instead of simulating
 	 */
 	enum ProgramState {
 		INIT,
 		SETUP,
 		RUNNING,
-		PAUSED
+		PAUSED,
+		REPLAY
 	};
 
 	// Initial application setup functions
@@ -41,18 +69,37 @@ private:
 	void AddBody();
 	void RemovePreviousBody();
 	void ReadXml();
+	bool ReadSnapshot();
+	bool ReadCsv();
+	void BuildSetupSpheres();
+	void SaveLineage();
+	void SaveCheckpoint();
+	void StopRecording();
+	void StartSimulation(bool resumed);
 
 	// Button handlers
 	void RunSimulation();
+	void ResumeSimulation();
+	void StartReplay();
 	void Step();
 	void Return();
 
+	// Slider handlers
+	void SetSpeed(double &speed);
+	void SetFrameBudget(double &milliseconds);
+	void SeekReplay(double &fraction);
+
 	// Update loop helper functions
+	void UpdateReplay();
 	void UpdateSimulationBodies();
+	void ApplyBodyChanges();
+	bool UseInstancedRendering();
+	bool UseDensityMap();
 
 	// Draw loop helper functions
 	void DrawSetupBodies();
 	void DrawSimulationBodies();
+	void DrawDensityMap();
 	void DrawGui();
 	void DrawInstructions();
 
@@ -62,8 +109,29 @@ private:
 	// Main simulation driver
 	PhysicsEngine *simulation_;
 
+	// Runs the simulation while it is RUNNING or PAUSED, nullptr during SETUP
+	SimulationThread *simulation_thread_;
+
 	// 3d objects, lights and camera
 	vector<ColoredSphere> body_spheres_;
+	// Id of the body each sphere represents while the simulation is running
+	vector<uint32_t> sphere_ids_;
+	// Changes to the bodies that have not been applied to the spheres yet
+	vector<BodyChange> body_changes_;
+	// Snapshot that is on screen and the interpolated positions of its bodies
+	const BodySnapshot *displayed_snapshot_;
+	vector<ofVec3f> display_positions_;
+	// Draws large simulations in a single call instead of sphere by sphere
+	InstancedBodyRenderer body_renderer_;
+	// Skips bodies that are off screen and picks how detailed the others are drawn
+	BodyCuller culler_;
+	ofSpherePrimitive low_poly_sphere_;
+	ofMesh point_mesh_;
+	// Shows how many bodies are behind each part of the screen for very large runs
+	DensityMap density_map_;
+	ofTexture density_texture_;
+	// Recent paths of the bodies, drawn when switched on
+	TrailRenderer trails_;
 	ofLight light_l_up_;
 	ofLight light_r_up_;
 	ofLight light_l_down_;
@@ -73,6 +141,19 @@ private:
 	// XML reader and writer
 	XmlHelper* xml_;
 
+	// Collision log for the current run
+	EventLog* event_log_;
+
+	// Trajectory recording of the current run, nullptr unless it is switched on
+	FrameSink* trajectory_sink_;
+	TrajectoryWriter* trajectory_writer_;
+
+	// Plays back the recorded trajectory while in REPLAY
+	TrajectoryPlayer player_;
+
+	// The trajectory file the last recording was written to
+	string last_recording_;
+
 	// GUI items
 	ofxPanel setup_gui_;
 	ofxVec3Slider position_slider_;
@@ -87,6 +168,11 @@ private:
 
 	ofxPanel run_gui_;
 	ofxButton run_button_;
+	ofxButton resume_button_;
+	ofxButton replay_button_;
+	ofxToggle record_button_;
+	ofxIntSlider record_interval_slider_;
+	ofxToggle compress_button_;
 
 	ofxPanel simulation_gui_;
 	ofxPanel pause_gui_;
@@ -94,4 +180,17 @@ private:
 	ofxButton step_button_;
 	ofxSlider<double> step_slider_;
 	ofxButton return_button_;
+	ofxToggle instanced_button_;
+	ofxToggle density_button_;
+	ofxToggle trails_button_;
+	ofxSlider<double> speed_slider_;
+	ofxSlider<double> budget_slider_;
+	ofxLabel speed_label_;
+
+	ofxPanel replay_gui_;
+	ofxToggle replay_play_button_;
+	ofxSlider<double> replay_speed_slider_;
+	ofxSlider<double> replay_position_slider_;
+	ofxButton replay_return_button_;
+	ofxLabel replay_time_label_;
 };
@@ -0,0 +1,144 @@
+#include "culling.h"
+#include "..\engines\parallel.h"
+
+#include <cmath>
+
+// Bodies are classified in chunks of at least this many
+static const int kMinClassifyChunk = 2048;
+
+/**
+ * Builds the frustum of a perspective camera.
+ *
+ * @param eye the position of the camera
+ * @param forward the direction the camera looks in
+ * @param up the up direction of the camera
+ * @param fov the vertical field of view in degrees
+ * @param viewport_width the width of the viewport in pixels
+ * @param viewport_height the height of the viewport in pixels
+ * @param far_clip the distance beyond which nothing is drawn, or 0 for no limit
+ */
+ViewFrustum::ViewFrustum(ofVec3f eye, ofVec3f forward, ofVec3f up, float fov,
+						 float viewport_width, float viewport_height, float far_clip)
+	: eye_(eye), forward_(forward.getNormalized()) {
+	ofVec3f right = forward_.getCrossed(up).getNormalized();
+	ofVec3f true_up = right.getCrossed(forward_);
+
+	float tan_y = std::tan(fov * 0.5f * (float)DEG_TO_RAD);
+	float tan_x = tan_y * viewport_width / viewport_height;
+	pixels_per_unit_ = viewport_height / (2 * tan_y);
+
+	// Each side plane contains the eye and one edge of the screen
+	ofVec3f normals[4] = {
+		(forward_ * tan_x + right).getNormalized(),
+		(forward_ * tan_x - right).getNormalized(),
+		(forward_ * tan_y + true_up).getNormalized(),
+		(forward_ * tan_y - true_up).getNormalized()
+	};
+
+	plane_count_ = 0;
+	for (const ofVec3f &normal : normals) {
+		planes_[plane_count_++] = { normal, -normal.dot(eye_) };
+	}
+
+	if (far_clip > 0) {
+		planes_[plane_count_++] = { -forward_, forward_.dot(eye_) + far_clip };
+	}
+}
+
+/**
+ * Checks whether any part of a sphere may be inside the frustum. Spheres near the
+ * corners can pass without being visible, but no visible sphere is rejected.
+ *
+ * @param center the center of the sphere
+ * @param radius the radius of the sphere
+ * @return false if the sphere is certainly outside the frustum
+ */
+bool ViewFrustum::Intersects(const ofVec3f &center, double radius) const {
+	if (CalculateDepth(center) < -radius) {
+		return false;
+	}
+
+	for (int i = 0; i < plane_count_; i++) {
+		if (planes_[i].normal.dot(center) + planes_[i].offset < -radius) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Returns the distance of a point in front of the camera, along the view direction.
+ */
+float ViewFrustum::CalculateDepth(const ofVec3f &point) const {
+	return (point - eye_).dot(forward_);
+}
+
+/**
+ * Returns the approximate radius in pixels of a sphere at the given depth.
+ */
+float ViewFrustum::CalculatePixelRadius(double radius, float depth) const {
+	return (float)radius * pixels_per_unit_ / depth;
+}
+
+/**
+ * Classifies every body for the given view. Bodies that the camera is inside of, or
+ * that are cut by the near plane, are always drawn as full spheres.
+ *
+ * @param frustum the view the bodies are drawn in
+ * @param positions the center of each body
+ * @param radii the radius of each body
+ */
+void BodyCuller::Classify(const ViewFrustum &frustum, ArrayView<ofVec3f> positions,
+						  ArrayView<double> radii) {
+	thread_bodies_.resize(CountWorkerThreads());
+	for (vector<vector<int>> &levels : thread_bodies_) {
+		levels.resize(DETAIL_LEVEL_COUNT);
+		for (vector<int> &bodies : levels) {
+			bodies.clear();
+		}
+	}
+
+	ParallelFor((int)positions.size(), kMinClassifyChunk, [&](int thread_idx, int begin, int end) {
+		vector<vector<int>> &levels = thread_bodies_[thread_idx];
+		for (int i = begin; i < end; i++) {
+			if (!frustum.Intersects(positions[i], radii[i])) {
+				levels[CULLED].push_back(i);
+				continue;
+			}
+
+			float depth = frustum.CalculateDepth(positions[i]);
+			if (depth <= radii[i]) {
+				levels[SPHERE].push_back(i);
+				continue;
+			}
+
+			float pixels = frustum.CalculatePixelRadius(radii[i], depth);
+			if (pixels < kMinLowPolyPixels) {
+				levels[POINT].push_back(i);
+			} else if (pixels < kMinSpherePixels) {
+				levels[LOW_POLY].push_back(i);
+			} else {
+				levels[SPHERE].push_back(i);
+			}
+		}
+	});
+
+	for (int level = 0; level < DETAIL_LEVEL_COUNT; level++) {
+		bodies_[level].clear();
+		for (const vector<vector<int>> &levels : thread_bodies_) {
+			bodies_[level].insert(bodies_[level].end(), levels[level].begin(), levels[level].end());
+		}
+	}
+}
+
+/**
+ * Returns the indices of the bodies given a detail level by the last call to Classify.
+ */
+const vector<int> &BodyCuller::GetBodies(DetailLevel level) const {
+	return bodies_[level];
+}
+
+size_t BodyCuller::CountBodies(DetailLevel level) const {
+	return bodies_[level].size();
+}
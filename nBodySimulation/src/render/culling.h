@@ -0,0 +1,80 @@
+#pragma once
+
+#include "..\engines\array_view.h"
+
+#include "ofVec3f.h"
+
+#include <vector>
+
+using std::vector;
+
+/**
+ * How a body is drawn, picked from how large it appears on screen.
+ *
+ * CULLED - outside the view, not drawn at all
+ * POINT - smaller than a pixel, drawn as a single point
+ * LOW_POLY - a few pixels across, drawn as a coarse sphere
+ * SPHERE - large enough to show the full sphere
+ */
+enum DetailLevel {
+	CULLED,
+	POINT,
+	LOW_POLY,
+	SPHERE,
+	DETAIL_LEVEL_COUNT
+};
+
+/**
+ * The volume a perspective camera can see, as the planes of its sides. Also knows how
+ * many pixels an object of a given size covers at a given depth.
+ */
+class ViewFrustum {
+public:
+	ViewFrustum(ofVec3f eye, ofVec3f forward, ofVec3f up, float fov,
+				float viewport_width, float viewport_height, float far_clip = 0);
+
+	bool Intersects(const ofVec3f &center, double radius) const;
+	float CalculateDepth(const ofVec3f &point) const;
+	float CalculatePixelRadius(double radius, float depth) const;
+
+private:
+	/**
+	 * A plane through the eye, with its normal pointing into the frustum.
+	 */
+	struct Plane {
+		ofVec3f normal;
+		float offset;
+	};
+
+	ofVec3f eye_;
+	ofVec3f forward_;
+	// Left, right, bottom and top sides, followed by the far plane if there is one
+	Plane planes_[5];
+	int plane_count_;
+	// Pixels covered by one unit of length at a depth of one unit
+	float pixels_per_unit_;
+};
+
+/**
+ * Sorts the bodies into detail levels for a view, so that bodies off screen are
+ * skipped and distant bodies are drawn with less detail. The bodies are classified
+ * in parallel, and the bodies of each level are listed in index order.
+ */
+class BodyCuller {
+public:
+	// Bodies with a radius on screen below this many pixels are drawn as points
+	static constexpr float kMinLowPolyPixels = 1.0f;
+	// Bodies with a radius on screen below this many pixels are drawn as coarse spheres
+	static constexpr float kMinSpherePixels = 8.0f;
+
+	void Classify(const ViewFrustum &frustum, ArrayView<ofVec3f> positions,
+				  ArrayView<double> radii);
+
+	const vector<int> &GetBodies(DetailLevel level) const;
+	size_t CountBodies(DetailLevel level) const;
+
+private:
+	// Bodies per level found by each thread, joined in thread order into bodies_
+	vector<vector<vector<int>>> thread_bodies_;
+	vector<int> bodies_[DETAIL_LEVEL_COUNT];
+};
@@ -0,0 +1,138 @@
+#include "density_map.h"
+#include "..\engines\parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Bodies are counted in chunks of at least this many
+static const int kMinCountChunk = 8192;
+
+// Bins are summed and colored in chunks of at least this many
+static const int kMinBinChunk = 4096;
+
+DensityMap::DensityMap() : width_(0), height_(0), max_count_(0) { }
+
+/**
+ * Counts the bodies in each bin and colors the map.
+ *
+ * @param camera the camera the bodies are seen through
+ * @param width the number of bins across the map
+ * @param height the number of bins down the map
+ * @param positions the position of each body
+ */
+void DensityMap::Build(const SplatCamera &camera, int width, int height,
+					   ArrayView<ofVec3f> positions) {
+	width_ = std::max(1, width);
+	height_ = std::max(1, height);
+
+	CountBodies(camera, positions);
+	SumHistograms();
+	ColorBins();
+}
+
+int DensityMap::GetWidth() const {
+	return width_;
+}
+
+int DensityMap::GetHeight() const {
+	return height_;
+}
+
+/**
+ * Returns the number of bodies in the fullest bin of the last map built.
+ */
+uint32_t DensityMap::GetMaxCount() const {
+	return max_count_;
+}
+
+const vector<unsigned char> &DensityMap::GetPixels() const {
+	return pixels_;
+}
+
+/**
+ * Counts the bodies into one histogram per thread, so the threads never write to
+ * the same bin.
+ */
+void DensityMap::CountBodies(const SplatCamera &camera, ArrayView<ofVec3f> positions) {
+	size_t bins = (size_t)width_ * height_;
+	ScreenProjection projection(camera, width_, height_);
+
+	thread_counts_.resize(CountWorkerThreads());
+	ParallelFor((int)positions.size(), kMinCountChunk, [&](int thread_idx, int begin, int end) {
+		vector<uint32_t> &counts = thread_counts_[thread_idx];
+		counts.assign(bins, 0);
+
+		for (int i = begin; i < end; i++) {
+			float x;
+			float y;
+			if (!projection.Project(positions[i], x, y)) {
+				continue;
+			}
+			if (x < 0 || x >= width_ || y < 0 || y >= height_) {
+				continue;
+			}
+
+			counts[(size_t)y * width_ + (size_t)x]++;
+		}
+	});
+}
+
+/**
+ * Adds the histograms of the threads together, splitting the bins between threads.
+ * Only the histograms that were filled by the last count are used.
+ */
+void DensityMap::SumHistograms() {
+	size_t bins = (size_t)width_ * height_;
+	counts_.resize(bins);
+
+	vector<uint32_t> thread_max(CountWorkerThreads(), 0);
+	ParallelFor((int)bins, kMinBinChunk, [&](int thread_idx, int begin, int end) {
+		uint32_t fullest = 0;
+		for (int bin = begin; bin < end; bin++) {
+			uint32_t count = 0;
+			for (const vector<uint32_t> &counts : thread_counts_) {
+				if (counts.size() == bins) {
+					count += counts[bin];
+				}
+			}
+
+			counts_[bin] = count;
+			fullest = std::max(fullest, count);
+		}
+		thread_max[thread_idx] = fullest;
+	});
+
+	max_count_ = *std::max_element(thread_max.begin(), thread_max.end());
+
+	// Histograms left over from a count that used fewer threads must not be added again
+	for (vector<uint32_t> &counts : thread_counts_) {
+		counts.clear();
+	}
+}
+
+/**
+ * Colors each bin by the log of its count, running from dark red through orange to
+ * white for the fullest bin. Empty bins are black.
+ */
+void DensityMap::ColorBins() {
+	size_t bins = (size_t)width_ * height_;
+	pixels_.resize(bins * 3);
+
+	float scale = (max_count_ > 0) ? 1.0f / std::log1p((float)max_count_) : 0.0f;
+
+	ParallelFor((int)bins, kMinBinChunk, [&](int /*thread_idx*/, int begin, int end) {
+		for (int bin = begin; bin < end; bin++) {
+			unsigned char *pixel = &pixels_[(size_t)bin * 3];
+			if (counts_[bin] == 0) {
+				pixel[0] = pixel[1] = pixel[2] = 0;
+				continue;
+			}
+
+			// Single bodies start at a quarter brightness so they do not vanish
+			float level = 0.25f + 0.75f * std::log1p((float)counts_[bin]) * scale;
+			pixel[0] = (unsigned char)(255 * std::min(1.0f, level * 3));
+			pixel[1] = (unsigned char)(255 * std::min(1.0f, std::max(0.0f, level * 3 - 1)));
+			pixel[2] = (unsigned char)(255 * std::min(1.0f, std::max(0.0f, level * 3 - 2)));
+		}
+	});
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "splat_renderer.h"
+
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Shows how many bodies are behind each part of the screen, for simulations too
+ * large to draw body by body.
+ *
+ * The bodies are projected through the camera and counted in a 2d histogram with one
+ * bin per cell of the screen. Each thread counts its own share of the bodies into its
+ * own histogram, and the histograms are then summed in parallel over the bins. The
+ * counts are shown on a log scale, so single bodies stay visible next to dense cores.
+ * Everything after the counting costs the same no matter how many bodies there are.
+ */
+class DensityMap {
+public:
+	DensityMap();
+
+	void Build(const SplatCamera &camera, int width, int height, ArrayView<ofVec3f> positions);
+
+	int GetWidth() const;
+	int GetHeight() const;
+	uint32_t GetMaxCount() const;
+	// Rows of tightly packed RGB pixels, from the top of the map down
+	const vector<unsigned char> &GetPixels() const;
+
+private:
+	void CountBodies(const SplatCamera &camera, ArrayView<ofVec3f> positions);
+	void SumHistograms();
+	void ColorBins();
+
+	int width_;
+	int height_;
+
+	vector<vector<uint32_t>> thread_counts_;
+	vector<uint32_t> counts_;
+	uint32_t max_count_;
+
+	vector<unsigned char> pixels_;
+};
@@ -0,0 +1,156 @@
+#include "instanced_renderer.h"
+
+// Moves and scales a unit sphere to each instance, given as center and radius
+static const string kVertexShader = R"(
+#version 120
+
+attribute vec4 instance_sphere;
+attribute vec4 instance_color;
+varying vec4 color;
+
+void main() {
+	vec4 world = vec4(gl_Vertex.xyz * instance_sphere.w + instance_sphere.xyz, 1.0);
+	gl_Position = gl_ModelViewProjectionMatrix * world;
+	color = instance_color;
+}
+)";
+
+static const string kFragmentShader = R"(
+#version 120
+
+varying vec4 color;
+
+void main() {
+	gl_FragColor = color;
+}
+)";
+
+/**
+ * Compiles the shader and builds the sphere meshes. Must be called once the GL context
+ * exists, before the first call to Draw.
+ */
+void InstancedBodyRenderer::Setup() {
+	shader_.setupShaderFromSource(GL_VERTEX_SHADER, kVertexShader);
+	shader_.setupShaderFromSource(GL_FRAGMENT_SHADER, kFragmentShader);
+	shader_.linkProgram();
+
+	SetupMesh(sphere_mesh_, kSphereResolution);
+	SetupMesh(low_poly_mesh_, kLowPolyResolution);
+	point_capacity_ = 0;
+}
+
+/**
+ * Draws the bodies at the detail levels picked by the culler, which must have
+ * classified the same bodies for the current view. Must be called between
+ * camera.begin() and camera.end().
+ *
+ * @param positions the center of each body
+ * @param radii the radius of each body
+ * @param colors the color of each body
+ * @param culler the detail level of each body
+ */
+void InstancedBodyRenderer::Draw(const vector<ofVec3f> &positions, const vector<double> &radii,
+								 const vector<ofColor> &colors, const BodyCuller &culler) {
+	ofPushStyle();
+	ofDisableLighting();
+
+	DrawMesh(sphere_mesh_, culler.GetBodies(SPHERE), positions, radii, colors);
+	DrawMesh(low_poly_mesh_, culler.GetBodies(LOW_POLY), positions, radii, colors);
+
+	const vector<int> &points = culler.GetBodies(POINT);
+	if (!points.empty()) {
+		point_positions_.clear();
+		point_colors_.clear();
+		for (int i : points) {
+			point_positions_.push_back(positions[i]);
+			point_colors_.push_back(colors[i]);
+		}
+
+		UploadPoints();
+		point_vbo_.draw(GL_POINTS, 0, point_positions_.size());
+	}
+
+	ofPopStyle();
+}
+
+/**
+ * Turns the triangles of a unit sphere into lines, to match the wireframe spheres.
+ */
+void InstancedBodyRenderer::SetupMesh(InstancedMesh &mesh, int resolution) {
+	ofMesh sphere = ofMesh::sphere(1, resolution);
+	vector<ofIndexType> lines;
+	const vector<ofIndexType> &triangles = sphere.getIndices();
+	for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+		lines.push_back(triangles[i]);
+		lines.push_back(triangles[i + 1]);
+		lines.push_back(triangles[i + 1]);
+		lines.push_back(triangles[i + 2]);
+		lines.push_back(triangles[i + 2]);
+		lines.push_back(triangles[i]);
+	}
+
+	mesh.vbo.setVertexData(sphere.getVerticesPointer(), sphere.getNumVertices(), GL_STATIC_DRAW);
+	mesh.vbo.setIndexData(lines.data(), lines.size(), GL_STATIC_DRAW);
+	mesh.index_count = lines.size();
+	mesh.instance_capacity = 0;
+}
+
+/**
+ * Draws the mesh once for each of the given bodies with a single draw call.
+ */
+void InstancedBodyRenderer::DrawMesh(InstancedMesh &mesh, const vector<int> &bodies,
+									 const vector<ofVec3f> &positions, const vector<double> &radii,
+									 const vector<ofColor> &colors) {
+	if (bodies.empty()) {
+		return;
+	}
+
+	mesh.instances.clear();
+	for (int i : bodies) {
+		mesh.instances.push_back({ ofVec4f(positions[i].x, positions[i].y, positions[i].z, radii[i]), colors[i] });
+	}
+
+	UploadInstances(mesh);
+
+	shader_.begin();
+	mesh.vbo.drawElementsInstanced(GL_LINES, mesh.index_count, mesh.instances.size());
+	shader_.end();
+}
+
+/**
+ * Copies the instance data of a mesh into its instance buffer, growing the buffer
+ * if needed, and points the shader attributes at it.
+ */
+void InstancedBodyRenderer::UploadInstances(InstancedMesh &mesh) {
+	size_t bytes = mesh.instances.size() * sizeof(Instance);
+
+	if (mesh.instances.size() > mesh.instance_capacity) {
+		mesh.instance_capacity = mesh.instances.size() * 2;
+		mesh.instance_buffer.allocate(mesh.instance_capacity * sizeof(Instance), GL_STREAM_DRAW);
+
+		int sphere_location = shader_.getAttributeLocation("instance_sphere");
+		int color_location = shader_.getAttributeLocation("instance_color");
+		mesh.vbo.setAttributeBuffer(sphere_location, mesh.instance_buffer, 4, sizeof(Instance), 0);
+		mesh.vbo.setAttributeBuffer(color_location, mesh.instance_buffer, 4, sizeof(Instance), sizeof(ofVec4f));
+		mesh.vbo.setAttributeDivisor(sphere_location, 1);
+		mesh.vbo.setAttributeDivisor(color_location, 1);
+	}
+
+	mesh.instance_buffer.updateData(0, bytes, mesh.instances.data());
+}
+
+/**
+ * Copies the positions and colors of the bodies drawn as points into their buffers,
+ * reallocating the buffers only when there are more points than ever before.
+ */
+void InstancedBodyRenderer::UploadPoints() {
+	if (point_positions_.size() > point_capacity_) {
+		point_capacity_ = point_positions_.size();
+		point_vbo_.setVertexData(&point_positions_[0], point_capacity_, GL_STREAM_DRAW);
+		point_vbo_.setColorData(&point_colors_[0], point_capacity_, GL_STREAM_DRAW);
+		return;
+	}
+
+	point_vbo_.updateVertexData(&point_positions_[0], point_positions_.size());
+	point_vbo_.updateColorData(&point_colors_[0], point_positions_.size());
+}
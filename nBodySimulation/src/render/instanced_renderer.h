@@ -0,0 +1,63 @@
+#pragma once
+
+#include "culling.h"
+
+#include "ofMain.h"
+
+#include <vector>
+
+using std::vector;
+
+/**
+ * Draws every body with a single instanced draw call instead of one call per sphere.
+ *
+ * Each frame the centers, radii and colors of the bodies are packed into a buffer
+ * and a wireframe sphere is drawn once per body by a shader that scales and moves it.
+ * The detail levels of a BodyCuller decide which bodies are skipped, which get a
+ * coarse sphere and which are drawn as points.
+ */
+class InstancedBodyRenderer {
+public:
+	void Setup();
+	void Draw(const vector<ofVec3f> &positions, const vector<double> &radii,
+			  const vector<ofColor> &colors, const BodyCuller &culler);
+
+private:
+	// Resolution of the sphere meshes for the SPHERE and LOW_POLY detail levels
+	static const int kSphereResolution = 12;
+	static const int kLowPolyResolution = 4;
+
+	/**
+	 * Layout of one body in the instance buffer.
+	 */
+	struct Instance {
+		ofVec4f sphere;
+		ofFloatColor color;
+	};
+
+	/**
+	 * A wireframe sphere mesh together with the bodies it is drawn for.
+	 */
+	struct InstancedMesh {
+		ofVbo vbo;
+		int index_count;
+		ofBufferObject instance_buffer;
+		size_t instance_capacity;
+		vector<Instance> instances;
+	};
+
+	void SetupMesh(InstancedMesh &mesh, int resolution);
+	void DrawMesh(InstancedMesh &mesh, const vector<int> &bodies, const vector<ofVec3f> &positions,
+				  const vector<double> &radii, const vector<ofColor> &colors);
+	void UploadInstances(InstancedMesh &mesh);
+	void UploadPoints();
+
+	ofShader shader_;
+	InstancedMesh sphere_mesh_;
+	InstancedMesh low_poly_mesh_;
+
+	ofVbo point_vbo_;
+	size_t point_capacity_;
+	vector<ofVec3f> point_positions_;
+	vector<ofFloatColor> point_colors_;
+};
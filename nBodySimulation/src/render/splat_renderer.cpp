@@ -0,0 +1,270 @@
+#include "splat_renderer.h"
+#include "..\engines\parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+// Bodies are projected in chunks of at least this many
+static const int kMinProjectChunk = 4096;
+
+// Brightest to darkest visible pixel that the tone mapping keeps apart
+static const float kDefaultExposure = 1000.0f;
+
+/**
+ * Places the camera on a sphere around the origin, looking at the origin with y up.
+ * With no rotation the camera sits on the +z axis, where ofEasyCam starts.
+ */
+SplatCamera SplatCamera::Orbit(float distance, float longitude, float latitude) {
+	float lon = longitude * (float)DEG_TO_RAD;
+	float lat = latitude * (float)DEG_TO_RAD;
+
+	SplatCamera camera;
+	camera.position = ofVec3f(std::cos(lat) * std::sin(lon),
+							  std::sin(lat),
+							  std::cos(lat) * std::cos(lon)) * distance;
+	camera.target = ofVec3f(0, 0, 0);
+	camera.up = ofVec3f(0, 1, 0);
+	camera.fov = 60.0f;
+	camera.near_clip = 0.1f;
+	return camera;
+}
+
+/**
+ * Works out the directions of the camera and the scale of the image once, so each
+ * point only needs a few dot products.
+ *
+ * @param camera the camera to project through
+ * @param width the width of the image in pixels
+ * @param height the height of the image in pixels
+ */
+ScreenProjection::ScreenProjection(const SplatCamera &camera, int width, int height)
+	: eye_(camera.position), near_clip_(camera.near_clip),
+	  half_width_(width * 0.5f), half_height_(height * 0.5f) {
+	forward_ = (camera.target - camera.position).getNormalized();
+	right_ = forward_.getCrossed(camera.up).getNormalized();
+	up_ = right_.getCrossed(forward_);
+
+	scale_y_ = 1.0f / std::tan(camera.fov * 0.5f * (float)DEG_TO_RAD);
+	scale_x_ = scale_y_ * height / width;
+}
+
+/**
+ * Creates a renderer for images of the given size, with the camera placed where
+ * the application puts its own camera.
+ *
+ * @param width the width of the image in pixels
+ * @param height the height of the image in pixels
+ */
+SplatRenderer::SplatRenderer(int width, int height)
+	: width_(std::max(1, width)),
+	  height_(std::max(1, height)),
+	  camera_(SplatCamera::Orbit(500, 0, 0)),
+	  exposure_(kDefaultExposure) {
+	framebuffer_.resize((size_t)width_ * height_ * 3);
+	pixels_.resize((size_t)width_ * height_ * 3);
+}
+
+void SplatRenderer::SetCamera(const SplatCamera &camera) {
+	camera_ = camera;
+}
+
+/**
+ * Sets how much the tone mapping brightens faint pixels. Pixels that received
+ * 1 / exposure of the light of the brightest pixel end up at about 10% brightness.
+ *
+ * @param exposure the ratio of the brightest to the faintest visible pixel
+ */
+void SplatRenderer::SetExposure(float exposure) {
+	exposure_ = std::max(1.0f, exposure);
+}
+
+/**
+ * Renders the bodies into the image, replacing the previous one.
+ *
+ * @param positions the position of each body
+ * @param masses the mass of each body, which sets how bright it is
+ * @param colors the color of each body
+ */
+void SplatRenderer::Render(ArrayView<ofVec3f> positions, ArrayView<double> masses,
+						   ArrayView<ofColor> colors) {
+	ProjectBodies(positions, masses, colors);
+	SortSplats();
+	AccumulateTiles();
+	ToneMap();
+}
+
+int SplatRenderer::GetWidth() const {
+	return width_;
+}
+
+int SplatRenderer::GetHeight() const {
+	return height_;
+}
+
+const vector<unsigned char> &SplatRenderer::GetPixels() const {
+	return pixels_;
+}
+
+/**
+ * Writes the image as a binary PPM file, which needs no image library to produce.
+ *
+ * @param file_name the path of the file to write
+ * @return true if the whole file was written
+ */
+bool SplatRenderer::WritePpm(const string &file_name) const {
+	std::ofstream out(file_name, std::ios::binary);
+	out << "P6\n" << width_ << " " << height_ << "\n255\n";
+	out.write((const char *)pixels_.data(), pixels_.size());
+	return out.good();
+}
+
+/**
+ * Projects every body to the screen. Each thread keeps the bodies of its own chunk,
+ * so the splats stay in body order when the chunks are joined.
+ */
+void SplatRenderer::ProjectBodies(ArrayView<ofVec3f> positions, ArrayView<double> masses,
+								  ArrayView<ofColor> colors) {
+	ScreenProjection projection(camera_, width_, height_);
+
+	thread_splats_.resize(CountWorkerThreads());
+	for (vector<Splat> &splats : thread_splats_) {
+		splats.clear();
+	}
+
+	ParallelFor((int)positions.size(), kMinProjectChunk, [&](int thread_idx, int begin, int end) {
+		vector<Splat> &splats = thread_splats_[thread_idx];
+		for (int i = begin; i < end; i++) {
+			float x;
+			float y;
+			if (!projection.Project(positions[i], x, y)) {
+				continue;
+			}
+
+			// Pixel centers are at half pixels, so a splat reaches half a pixel around them
+			if (x < -0.5f || x >= width_ + 0.5f || y < -0.5f || y >= height_ + 0.5f) {
+				continue;
+			}
+
+			int row = std::min(height_ - 1, std::max(-1, (int)std::floor(y - 0.5f)));
+			float weight = (float)masses[i] / 255.0f;
+			splats.push_back({ x, y, row, colors[i].r * weight, colors[i].g * weight, colors[i].b * weight });
+		}
+	});
+}
+
+/**
+ * Counting sorts the splats by the upper row they touch, so each tile can find the
+ * splats that reach into it without looking at the others.
+ */
+void SplatRenderer::SortSplats() {
+	row_offsets_.assign(height_ + 2, 0);
+	for (const vector<Splat> &splats : thread_splats_) {
+		for (const Splat &splat : splats) {
+			row_offsets_[splat.row + 2]++;
+		}
+	}
+
+	for (size_t y = 1; y < row_offsets_.size(); y++) {
+		row_offsets_[y] += row_offsets_[y - 1];
+	}
+
+	// Walking the splats in order keeps the sort stable, and the sums deterministic
+	splats_.resize(row_offsets_.back());
+	vector<int> next(row_offsets_.begin(), row_offsets_.end() - 1);
+	for (const vector<Splat> &splats : thread_splats_) {
+		for (const Splat &splat : splats) {
+			splats_[next[splat.row + 1]++] = splat;
+		}
+	}
+}
+
+/**
+ * Adds each splat to the four pixels around it. The tiles are split between the
+ * threads, and a splat on the edge of a tile is added by both tiles to their own rows.
+ */
+void SplatRenderer::AccumulateTiles() {
+	int tile_count = (height_ + kTileRows - 1) / kTileRows;
+
+	ParallelFor(tile_count, 1, [this](int /*thread_idx*/, int begin_tile, int end_tile) {
+		for (int tile = begin_tile; tile < end_tile; tile++) {
+			int begin_row = tile * kTileRows;
+			int end_row = std::min(height_, begin_row + kTileRows);
+
+			std::fill(framebuffer_.begin() + (size_t)begin_row * width_ * 3,
+					  framebuffer_.begin() + (size_t)end_row * width_ * 3, 0.0f);
+
+			// Splats whose upper row is just above the tile still reach its first row
+			int first = row_offsets_[begin_row];
+			int last = row_offsets_[end_row + 1];
+			for (int s = first; s < last; s++) {
+				const Splat &splat = splats_[s];
+				float fx = splat.x - 0.5f;
+				float fy = splat.y - 0.5f;
+				int x0 = (int)std::floor(fx);
+				int y0 = splat.row;
+				float tx = fx - x0;
+				float ty = std::min(1.0f, std::max(0.0f, fy - y0));
+
+				for (int dy = 0; dy < 2; dy++) {
+					int y = y0 + dy;
+					if (y < begin_row || y >= end_row) {
+						continue;
+					}
+
+					float wy = dy ? ty : 1.0f - ty;
+					for (int dx = 0; dx < 2; dx++) {
+						int x = x0 + dx;
+						if (x < 0 || x >= width_) {
+							continue;
+						}
+
+						float w = wy * (dx ? tx : 1.0f - tx);
+						float *pixel = &framebuffer_[((size_t)y * width_ + x) * 3];
+						pixel[0] += splat.red * w;
+						pixel[1] += splat.green * w;
+						pixel[2] += splat.blue * w;
+					}
+				}
+			}
+		}
+	});
+}
+
+/**
+ * Maps the accumulated light to 8 bits on a log scale relative to the brightest
+ * pixel. Each pixel is scaled as a whole, so its hue stays the same.
+ */
+void SplatRenderer::ToneMap() {
+	int pixel_count = width_ * height_;
+
+	vector<float> thread_max(CountWorkerThreads(), 0.0f);
+	ParallelFor(pixel_count, kMinProjectChunk, [&](int thread_idx, int begin, int end) {
+		float brightest = 0.0f;
+		for (size_t i = (size_t)begin * 3; i < (size_t)end * 3; i++) {
+			brightest = std::max(brightest, framebuffer_[i]);
+		}
+		thread_max[thread_idx] = brightest;
+	});
+
+	float brightest = *std::max_element(thread_max.begin(), thread_max.end());
+	if (brightest <= 0.0f) {
+		std::fill(pixels_.begin(), pixels_.end(), 0);
+		return;
+	}
+
+	float scale = exposure_ / brightest;
+	float normalize = 255.0f / std::log1p(exposure_);
+
+	ParallelFor(pixel_count, kMinProjectChunk, [&](int /*thread_idx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const float *pixel = &framebuffer_[(size_t)i * 3];
+			float value = std::max(pixel[0], std::max(pixel[1], pixel[2]));
+			float gain = (value > 0.0f) ? std::log1p(value * scale) * normalize / value : 0.0f;
+
+			for (int c = 0; c < 3; c++) {
+				pixels_[(size_t)i * 3 + c] = (unsigned char)std::min(255.0f, pixel[c] * gain + 0.5f);
+			}
+		}
+	});
+}
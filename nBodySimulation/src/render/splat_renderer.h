@@ -0,0 +1,138 @@
+#pragma once
+
+#include "..\engines\array_view.h"
+
+#include "ofVec3f.h"
+#include "ofColor.h"
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * Pinhole camera using the same conventions as a default ofEasyCam: a 60 degree
+ * vertical field of view with y up, looking at a target it orbits around.
+ */
+struct SplatCamera {
+	ofVec3f position;
+	ofVec3f target;
+	ofVec3f up;
+	// Vertical field of view in degrees
+	float fov;
+	// Bodies closer to the camera than this are not drawn
+	float near_clip;
+
+	/**
+	 * Places the camera on a sphere around the origin, like dragging an ofEasyCam.
+	 *
+	 * @param distance the distance from the origin, as set by ofEasyCam::setDistance
+	 * @param longitude rotation around the y axis in degrees, starting from the +z axis
+	 * @param latitude rotation above the xz plane in degrees
+	 * @return the camera
+	 */
+	static SplatCamera Orbit(float distance, float longitude, float latitude);
+};
+
+/**
+ * A SplatCamera prepared for projecting many points onto an image of a given size.
+ */
+class ScreenProjection {
+public:
+	ScreenProjection(const SplatCamera &camera, int width, int height);
+
+	/**
+	 * Projects a point onto the image, in pixels from the top left corner.
+	 *
+	 * @return false if the point is behind the near clip plane of the camera
+	 */
+	bool Project(const ofVec3f &point, float &x, float &y) const {
+		ofVec3f offset = point - eye_;
+		float depth = offset.dot(forward_);
+		if (depth < near_clip_) {
+			return false;
+		}
+
+		x = (offset.dot(right_) * scale_x_ / depth + 1.0f) * half_width_;
+		y = (1.0f - offset.dot(up_) * scale_y_ / depth) * half_height_;
+		return true;
+	}
+
+private:
+	ofVec3f eye_;
+	ofVec3f forward_;
+	ofVec3f right_;
+	ofVec3f up_;
+	float near_clip_;
+	// Screen coordinates run from -1 to 1 across the field of view
+	float scale_x_;
+	float scale_y_;
+	float half_width_;
+	float half_height_;
+};
+
+/**
+ * Software renderer for running without a display. Every body is projected through a
+ * SplatCamera and splatted into a floating point framebuffer, weighted by its mass and
+ * color, which is then tone mapped to 8 bit RGB. Dense regions therefore show up
+ * brighter instead of being drawn over each other.
+ *
+ * The framebuffer is split into tiles of whole rows. The splats are sorted by row so
+ * each thread only writes to its own tiles, which keeps the result the same for any
+ * number of threads.
+ */
+class SplatRenderer {
+public:
+	SplatRenderer(int width, int height);
+
+	void SetCamera(const SplatCamera &camera);
+	void SetExposure(float exposure);
+
+	void Render(ArrayView<ofVec3f> positions, ArrayView<double> masses,
+				ArrayView<ofColor> colors);
+
+	int GetWidth() const;
+	int GetHeight() const;
+	// Rows of tightly packed RGB pixels, from the top of the image down
+	const vector<unsigned char> &GetPixels() const;
+
+	bool WritePpm(const string &file_name) const;
+
+private:
+	// Height of the tiles each thread accumulates on its own
+	static const int kTileRows = 16;
+
+	/**
+	 * A projected body, with its position in pixels, the upper of the two rows it
+	 * touches (-1 to height - 1) and its weighted color.
+	 */
+	struct Splat {
+		float x;
+		float y;
+		int row;
+		float red;
+		float green;
+		float blue;
+	};
+
+	void ProjectBodies(ArrayView<ofVec3f> positions, ArrayView<double> masses,
+					   ArrayView<ofColor> colors);
+	void SortSplats();
+	void AccumulateTiles();
+	void ToneMap();
+
+	int width_;
+	int height_;
+	SplatCamera camera_;
+	float exposure_;
+
+	// Projected bodies per thread, and all of them sorted by row
+	vector<vector<Splat>> thread_splats_;
+	vector<Splat> splats_;
+	// Splats that touch rows y and y + 1 are in [row_offsets_[y + 1], row_offsets_[y + 2])
+	vector<int> row_offsets_;
+
+	vector<float> framebuffer_;
+	vector<unsigned char> pixels_;
+};
@@ -0,0 +1,185 @@
+#include "trails.h"
+
+#include <algorithm>
+
+const int TrailRenderer::kTrailLength;
+
+// Number of slots reserved the first time trails are recorded
+static const size_t kInitialSlots = 64;
+
+TrailRenderer::TrailRenderer() : frame_(0), colors_changed_(false), vbo_capacity_(0) { }
+
+/**
+ * Adds the current position of every body to its trail. Bodies that are new get an
+ * empty trail, and the trails of bodies that are gone are freed. A body that has not
+ * moved since the last call keeps its trail as it is, so pausing does not fill the
+ * trails with copies of the same point.
+ *
+ * @param ids the id of each body
+ * @param positions the position of each body
+ * @param colors the color of each body, used for its trail
+ */
+void TrailRenderer::Update(const vector<uint32_t> &ids, const vector<ofVec3f> &positions,
+						   const vector<ofColor> &colors) {
+	frame_++;
+
+	if (ids.size() > trails_.size()) {
+		Grow(std::max(ids.size(), trails_.size() * 2));
+	}
+
+	for (size_t i = 0; i < ids.size(); i++) {
+		auto slot_iterator = slots_.find(ids[i]);
+		int slot;
+		if (slot_iterator == slots_.end()) {
+			slot = AssignSlot(ids[i], positions[i], colors[i]);
+		} else {
+			slot = slot_iterator->second;
+		}
+
+		Trail &trail = trails_[slot];
+		trail.frame = frame_;
+
+		ofVec3f *ring = &vertices_[(size_t)slot * 2 * kTrailLength];
+		if (trail.length > 0 && ring[trail.head] == positions[i]) {
+			continue;
+		}
+
+		trail.head = (trail.head + 1) % kTrailLength;
+		trail.length = std::min(trail.length + 1, kTrailLength);
+		ring[trail.head] = positions[i];
+		ring[trail.head + kTrailLength] = positions[i];
+	}
+
+	FreeUnusedSlots(ids.size());
+}
+
+/**
+ * Draws every trail with at least two points. Must be called between camera.begin()
+ * and camera.end().
+ */
+void TrailRenderer::Draw() {
+	firsts_.clear();
+	counts_.clear();
+	for (size_t slot = 0; slot < trails_.size(); slot++) {
+		const Trail &trail = trails_[slot];
+		if (trail.length < 2) {
+			continue;
+		}
+
+		// The newest point is at head + kTrailLength, preceded by the older ones
+		firsts_.push_back((GLint)(slot * 2 * kTrailLength + trail.head + kTrailLength - trail.length + 1));
+		counts_.push_back(trail.length);
+	}
+
+	if (firsts_.empty()) {
+		return;
+	}
+
+	if (vertices_.size() > vbo_capacity_) {
+		vbo_capacity_ = vertices_.size();
+		vbo_.setVertexData(vertices_.data(), vbo_capacity_, GL_DYNAMIC_DRAW);
+		vbo_.setColorData(colors_.data(), vbo_capacity_, GL_DYNAMIC_DRAW);
+		colors_changed_ = false;
+	} else {
+		vbo_.updateVertexData(vertices_.data(), vertices_.size());
+		if (colors_changed_) {
+			vbo_.updateColorData(colors_.data(), colors_.size());
+			colors_changed_ = false;
+		}
+	}
+
+	ofPushStyle();
+	ofDisableLighting();
+	vbo_.bind();
+	glMultiDrawArrays(GL_LINE_STRIP, firsts_.data(), counts_.data(), (GLsizei)firsts_.size());
+	vbo_.unbind();
+	ofPopStyle();
+}
+
+/**
+ * Forgets every trail, keeping the storage for the next run.
+ */
+void TrailRenderer::Clear() {
+	if (slots_.empty()) {
+		return;
+	}
+
+	slots_.clear();
+	free_slots_.clear();
+	for (int slot = (int)trails_.size() - 1; slot >= 0; slot--) {
+		trails_[slot].length = 0;
+		free_slots_.push_back(slot);
+	}
+}
+
+/**
+ * Makes room for more trails.
+ */
+void TrailRenderer::Grow(size_t slots) {
+	slots = std::max(slots, kInitialSlots);
+	size_t old_slots = trails_.size();
+
+	trails_.resize(slots, { 0, 0, 0, 0 });
+	vertices_.resize(slots * 2 * kTrailLength);
+	colors_.resize(slots * 2 * kTrailLength);
+
+	free_slots_.reserve(slots);
+	for (int slot = (int)slots - 1; slot >= (int)old_slots; slot--) {
+		free_slots_.push_back(slot);
+	}
+
+	firsts_.reserve(slots);
+	counts_.reserve(slots);
+	slots_.reserve(slots);
+}
+
+/**
+ * Gives a new body a free slot, starting its trail at its current position.
+ *
+ * @return the slot of the body
+ */
+int TrailRenderer::AssignSlot(uint32_t id, const ofVec3f &position, const ofColor &color) {
+	// Bodies that are gone only give their slots back after the update
+	if (free_slots_.empty()) {
+		Grow(trails_.size() * 2);
+	}
+
+	int slot = free_slots_.back();
+	free_slots_.pop_back();
+	slots_[id] = slot;
+
+	Trail &trail = trails_[slot];
+	trail.id = id;
+	trail.head = 0;
+	trail.length = 1;
+
+	size_t base = (size_t)slot * 2 * kTrailLength;
+	vertices_[base] = position;
+	vertices_[base + kTrailLength] = position;
+	std::fill(colors_.begin() + base, colors_.begin() + base + 2 * kTrailLength, ofFloatColor(color));
+	colors_changed_ = true;
+
+	return slot;
+}
+
+/**
+ * Frees the slots of bodies that were not part of the last update, such as bodies
+ * that merged into another one.
+ *
+ * @param body_count the number of bodies in the last update
+ */
+void TrailRenderer::FreeUnusedSlots(size_t body_count) {
+	// Every slot in use belongs to one of the bodies, so none can be unused
+	if (slots_.size() == body_count) {
+		return;
+	}
+
+	for (size_t slot = 0; slot < trails_.size(); slot++) {
+		Trail &trail = trails_[slot];
+		if (trail.length > 0 && trail.frame != frame_) {
+			slots_.erase(trail.id);
+			trail.length = 0;
+			free_slots_.push_back((int)slot);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Draws the recent path of every body as a line, to help with reading orbits.
+ *
+ * Each body gets a slot holding its last kTrailLength positions in a ring. Every
+ * position is written twice, at its place in the ring and again kTrailLength places
+ * later, so the points from oldest to newest are always next to each other in memory
+ * and each trail is drawn as one line strip. The slots live in a single vertex buffer
+ * that is updated in place, and all of the trails are drawn with one glMultiDrawArrays
+ * call. Storage is only allocated when there are more bodies than ever before, never
+ * for an ordinary frame.
+ */
+class TrailRenderer {
+public:
+	// Number of positions kept for each body
+	static const int kTrailLength = 128;
+
+	TrailRenderer();
+
+	void Update(const vector<uint32_t> &ids, const vector<ofVec3f> &positions,
+				const vector<ofColor> &colors);
+	void Draw();
+	void Clear();
+
+private:
+	/**
+	 * The trail of one body. head is the ring position of the newest point.
+	 */
+	struct Trail {
+		uint32_t id;
+		int head;
+		int length;
+		// Frame in which the body was last seen, to find the slots of removed bodies
+		uint64_t frame;
+	};
+
+	void Grow(size_t slots);
+	int AssignSlot(uint32_t id, const ofVec3f &position, const ofColor &color);
+	void FreeUnusedSlots(size_t body_count);
+
+	vector<Trail> trails_;
+	vector<int> free_slots_;
+	std::unordered_map<uint32_t, int> slots_;
+	uint64_t frame_;
+
+	// Two copies of the ring of every slot, back to back
+	vector<ofVec3f> vertices_;
+	vector<ofFloatColor> colors_;
+	bool colors_changed_;
+
+	ofVbo vbo_;
+	size_t vbo_capacity_;
+
+	// Arguments of the draw call, one entry for each trail with at least two points
+	vector<GLint> firsts_;
+	vector<GLsizei> counts_;
+};
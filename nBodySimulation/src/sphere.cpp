@@ -0,0 +1,44 @@
+#include "sphere.h"
+
+/**
+ * Creates a list of spheres from the bodies in a simulation. The spheres are sized
+ * using the radii cached by the engine, so no radius is recalculated here.
+ *
+ * @param simulation the engine whose bodies are to be drawn
+ * @return a sphere for each body, in the same order as the engine's bodies
+ */
+vector<ColoredSphere> ColoredSphere::ParseBodies(const PhysicsEngine *simulation) {
+	return ParseBodies(simulation->GetPositions(), simulation->GetRadii(), simulation->GetColors());
+}
+
+/**
+ * Creates a list of spheres from a snapshot published by the simulation thread.
+ *
+ * @param snapshot the state of the bodies to be drawn
+ * @return a sphere for each body, in the same order as the snapshot
+ */
+vector<ColoredSphere> ColoredSphere::ParseBodies(const BodySnapshot &snapshot) {
+	return ParseBodies(ArrayView<ofVec3f>(snapshot.positions.data(), snapshot.positions.size()),
+					   ArrayView<double>(snapshot.radii.data(), snapshot.radii.size()),
+					   ArrayView<ofColor>(snapshot.colors.data(), snapshot.colors.size()));
+}
+
+/**
+ * Helper function that builds the spheres from the body arrays.
+ */
+vector<ColoredSphere> ColoredSphere::ParseBodies(ArrayView<ofVec3f> positions,
+		ArrayView<double> radii, ArrayView<ofColor> colors) {
+	vector<ColoredSphere> spheres;
+	spheres.reserve(positions.size());
+
+	for (size_t i = 0; i < positions.size(); i++) {
+		ColoredSphere sp;
+		sp.sphere.setRadius(radii[i]);
+		sp.sphere.setPosition(positions[i]);
+		sp.color.set(colors[i]);
+
+		spheres.push_back(sp);
+	}
+
+	return spheres;
+}
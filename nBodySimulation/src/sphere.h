@@ -0,0 +1,27 @@
+#pragma once
+
+#include "ofMain.h"
+#include "engines\physics_engine.h"
+#include "engines\snapshot_ring.h"
+
+#include <vector>
+
+using std::vector;
+
+/**
+ * Bridge between the physics engine and the renderer. Pairs the 3d sphere that
+ * represents a body with the color it should be drawn in.
+ */
+struct ColoredSphere {
+	ofSpherePrimitive sphere;
+	ofColor color;
+
+	// Builds a sphere for every body currently in the simulation
+	static vector<ColoredSphere> ParseBodies(const PhysicsEngine *simulation);
+	// Builds a sphere for every body in a snapshot of the simulation
+	static vector<ColoredSphere> ParseBodies(const BodySnapshot &snapshot);
+
+private:
+	static vector<ColoredSphere> ParseBodies(ArrayView<ofVec3f> positions,
+		ArrayView<double> radii, ArrayView<ofColor> colors);
+};
@@ -1,6 +1,20 @@
 #include "catch.hpp"
 #include "engines\few_body.h"
+#include "engines\initial_conditions.h"
+#include "engines\parallel.h"
+#include "io\compressed_trajectory.h"
+#include "io\csv_importer.h"
+#include "io\indexed_trajectory.h"
+#include "io\output_selector.h"
+#include "io\snapshot.h"
+#include "io\trajectory_player.h"
+#include "io\trajectory_writer.h"
 #include "ofVec3f.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
 //
 //TEST_CASE("Single body moves", "[few]") {
 //	FewBodyEngine fbe(1);
@@ -20,4 +34,541 @@
 //		ofVec3f expected(i*1, i*2, i*3);
 //		REQUIRE(fbe.GetBodyPositions()[0] == expected);
 //	}
-//}
\ No newline at end of file
+//}
+
+TEST_CASE("Overlapping bodies merge inelastically", "[few]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(0, 0, 0, 0, 0, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(1, 0, 0, 0, 0, 0, 1, ofColor(0, 0, 255));
+	fbe.update();
+
+	REQUIRE(fbe.CountBodies() == 1);
+}
+
+TEST_CASE("Distant bodies do not collide", "[few]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(-100, 0, 0, 0, 0, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(100, 0, 0, 0, 0, 0, 1, ofColor(0, 0, 255));
+	fbe.update();
+
+	REQUIRE(fbe.CountBodies() == 2);
+}
+
+TEST_CASE("Chained contacts merge into a single body", "[few]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(0, 0, 0, 0, 0, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(1, 0, 0, 0, 0, 0, 1, ofColor(0, 255, 0));
+	fbe.AddBody(2, 0, 0, 0, 0, 0, 1, ofColor(0, 0, 255));
+	fbe.update();
+
+	REQUIRE(fbe.CountBodies() == 1);
+}
+
+TEST_CASE("Collisions do not depend on the thread count", "[few]") {
+	vector<vector<ofVec3f>> results;
+	for (int threads : { 1, 3, 8 }) {
+		SetWorkerThreads(threads);
+
+		FewBodyEngine fbe(0.5, false);
+		for (int i = 0; i < 400; i++) {
+			fbe.AddBody((i * 37) % 101, (i * 53) % 97, (i * 71) % 89,
+						(i % 7) - 3, (i % 5) - 2, (i % 3) - 1, 1 + i % 4, ofColor(i % 255, 0, 0));
+		}
+
+		for (int step = 0; step < 5; step++) {
+			fbe.update();
+		}
+		results.push_back(fbe.GetBodyPositions());
+	}
+	SetWorkerThreads(0);
+
+	REQUIRE(results[0] == results[1]);
+	REQUIRE(results[0] == results[2]);
+}
+
+TEST_CASE("Merges are recorded in the lineage", "[few]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(0, 0, 0, 0, 0, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(1, 0, 0, 0, 0, 0, 1, ofColor(0, 0, 255));
+	fbe.AddBody(500, 0, 0, 0, 0, 0, 1, ofColor(0, 255, 0));
+	fbe.update();
+
+	const LineageTable &lineage = fbe.GetLineage();
+	REQUIRE(lineage.CountBodies() == 3);
+	REQUIRE(lineage.GetParent(1) == 0);
+	REQUIRE(lineage.GetFirstChild(0) == 1);
+	REQUIRE(lineage.GetNextSibling(1) == LineageTable::kNone);
+	REQUIRE_FALSE(lineage.IsMerged(0));
+	REQUIRE_FALSE(lineage.IsMerged(2));
+	REQUIRE(fbe.GetBodyIds() == vector<uint32_t>({ 0, 2 }));
+}
+
+TEST_CASE("Views reflect the bodies and the version changes on update", "[few]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(-100, 0, 0, 1, 0, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(100, 0, 0, -1, 0, 0, 2, ofColor(0, 0, 255));
+
+	uint64_t version = fbe.GetVersion();
+	fbe.update();
+
+	ArrayView<ofVec3f> positions = fbe.GetPositions();
+	REQUIRE(fbe.GetVersion() != version);
+	REQUIRE(positions.size() == 2);
+	REQUIRE(positions[0] == fbe.GetBodyPositions()[0]);
+	REQUIRE(fbe.GetMasses()[1] == 2);
+	REQUIRE(fbe.GetIds()[1] == 1);
+}
+
+TEST_CASE("Snapshots load back into an engine", "[snapshot]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(-100, 5, 0, 1, 0, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(100, 0, 7, -1, 0, 2, 2, ofColor(0, 0, 255));
+	REQUIRE(SnapshotFile::Write("snapshot_test.nbs", fbe));
+
+	SnapshotFile snapshot;
+	REQUIRE(snapshot.Open("snapshot_test.nbs"));
+	REQUIRE(snapshot.CountBodies() == 2);
+
+	FewBodyEngine loaded(1, false);
+	REQUIRE(snapshot.Load(loaded));
+	snapshot.Close();
+	std::remove("snapshot_test.nbs");
+
+	REQUIRE(loaded.GetBodyPositions() == fbe.GetBodyPositions());
+	REQUIRE(loaded.GetVelocities()[1] == fbe.GetVelocities()[1]);
+	REQUIRE(loaded.GetMasses()[1] == 2);
+	REQUIRE(loaded.GetRadii()[1] == fbe.GetRadii()[1]);
+	REQUIRE(loaded.GetColors()[0] == ofColor(255, 0, 0));
+	REQUIRE(loaded.GetBodyIds() == vector<uint32_t>({ 0, 1 }));
+}
+
+/**
+ * Keeps the frames in memory instead of writing them to a file.
+ */
+class MemoryFrameSink : public FrameSink {
+public:
+	bool WriteFrame(const TrajectoryFrame &frame) override {
+		frames.push_back(frame);
+		return true;
+	}
+
+	vector<TrajectoryFrame> frames;
+};
+
+TEST_CASE("Trajectories keep every nth step in order", "[trajectory]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(-100, 0, 0, 1, 0, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(100, 0, 0, -1, 0, 0, 2, ofColor(0, 0, 255));
+
+	MemoryFrameSink sink;
+	TrajectoryWriter writer(&sink, 3);
+	for (uint64_t step = 1; step <= 10; step++) {
+		fbe.update();
+		writer.Capture(fbe, step);
+	}
+	writer.Finish();
+
+	REQUIRE_FALSE(writer.HasFailed());
+	REQUIRE(writer.CountFramesWritten() == 3);
+	REQUIRE(sink.frames.size() == 3);
+	REQUIRE(sink.frames[0].step == 3);
+	REQUIRE(sink.frames[2].step == 9);
+	REQUIRE(sink.frames[2].masses == vector<double>({ 1, 2 }));
+	REQUIRE(sink.frames[2].ids == vector<uint32_t>({ 0, 1 }));
+	REQUIRE(sink.frames[0].positions[0].x < sink.frames[2].positions[0].x);
+}
+
+TEST_CASE("Restored checkpoints continue bit for bit", "[checkpoint]") {
+	FewBodyEngine fbe(0.5, false);
+	fbe.AddBody(-100, 0, 0, 3, 0, 0, 5, ofColor(255, 0, 0));
+	fbe.AddBody(100, 0, 0, -3, 0, 0, 5, ofColor(0, 0, 255));
+	fbe.AddBody(0, 80, 0, 0, 0, 1, 1, ofColor(0, 255, 0));
+	for (int i = 0; i < 10; i++) {
+		fbe.update();
+	}
+
+	std::stringstream checkpoint;
+	REQUIRE(fbe.WriteCheckpoint(checkpoint));
+
+	FewBodyEngine restored(1, true);
+	REQUIRE(restored.ReadCheckpoint(checkpoint));
+	REQUIRE(restored.GetTime() == fbe.GetTime());
+	REQUIRE(restored.CountSteps() == 10);
+	REQUIRE_FALSE(restored.HasElasticCollisions());
+
+	// Long enough for the two heavy bodies to meet and merge
+	for (int i = 0; i < 100; i++) {
+		fbe.update();
+		restored.update();
+	}
+
+	REQUIRE(restored.CountBodies() == fbe.CountBodies());
+	REQUIRE(restored.GetBodyPositions() == fbe.GetBodyPositions());
+	REQUIRE(restored.GetVelocities()[0] == fbe.GetVelocities()[0]);
+	REQUIRE(restored.GetBodyIds() == fbe.GetBodyIds());
+	REQUIRE(restored.GetLineage().CountBodies() == 3);
+}
+
+TEST_CASE("Truncated checkpoints leave the engine unchanged", "[checkpoint]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(0, 0, 0, 1, 0, 0, 1, ofColor(255, 0, 0));
+	std::stringstream checkpoint;
+	REQUIRE(fbe.WriteCheckpoint(checkpoint));
+
+	string truncated = checkpoint.str();
+	truncated.resize(truncated.size() - 1);
+	std::stringstream in(truncated);
+
+	FewBodyEngine other(1, false);
+	other.AddBody(5, 5, 5, 0, 0, 0, 2, ofColor(0, 0, 255));
+	REQUIRE_FALSE(other.ReadCheckpoint(in));
+	REQUIRE(other.CountBodies() == 1);
+	REQUIRE(other.GetMasses()[0] == 2);
+
+	// A damaged body count is rejected before anything is allocated for it
+	string damaged = checkpoint.str();
+	uint64_t count = 0xffffffff;
+	uint32_t next_id = 0xffffffff;
+	std::memcpy(&damaged[8], &count, sizeof(count));
+	std::memcpy(&damaged[32], &next_id, sizeof(next_id));
+	std::stringstream damaged_in(damaged);
+	REQUIRE_FALSE(other.ReadCheckpoint(damaged_in));
+	REQUIRE(other.CountBodies() == 1);
+
+	// So are ids and lineage links beyond the last id handed out. The checkpoint ends
+	// with the id of its one body, then a lineage of 12 header bytes and 20 per body
+	string bad_id = checkpoint.str();
+	uint32_t id = 1;
+	std::memcpy(&bad_id[bad_id.size() - 36], &id, sizeof(id));
+	std::stringstream bad_id_in(bad_id);
+	REQUIRE_FALSE(other.ReadCheckpoint(bad_id_in));
+
+	string bad_parent = checkpoint.str();
+	std::memcpy(&bad_parent[bad_parent.size() - 20], &id, sizeof(id));
+	std::stringstream bad_parent_in(bad_parent);
+	REQUIRE_FALSE(other.ReadCheckpoint(bad_parent_in));
+	REQUIRE(other.CountBodies() == 1);
+	REQUIRE(other.GetMasses()[0] == 2);
+}
+
+TEST_CASE("Compressed trajectories decode within the error bound", "[trajectory]") {
+	// Enough bodies for several blocks, moving smoothly
+	TrajectoryFrame frame;
+	for (uint32_t i = 0; i < 10000; i++) {
+		frame.positions.push_back(ofVec3f(i * 0.37f, std::sin(i * 0.1f) * 300, -50.0f + i % 97));
+		frame.velocities.push_back(ofVec3f(std::cos(i * 0.2f), 1, -0.5f));
+		frame.masses.push_back(1 + i % 7);
+		frame.ids.push_back(i);
+	}
+
+	vector<TrajectoryFrame> frames;
+	{
+		CompressedFrameSink sink("trajectory_test.nbtz", 0.01, 0.001);
+		for (int f = 0; f < 4; f++) {
+			frame.step = f;
+			frame.time = f * 0.5;
+			for (size_t i = 0; i < frame.positions.size(); i++) {
+				frame.positions[i] += frame.velocities[i] * 0.5f;
+			}
+
+			// Merging a body forces a key frame with the new ids and masses
+			if (f == 2) {
+				frame.positions.pop_back();
+				frame.velocities.pop_back();
+				frame.masses.pop_back();
+				frame.ids.pop_back();
+				frame.masses[0] = 20;
+			}
+
+			REQUIRE(sink.WriteFrame(frame));
+			frames.push_back(frame);
+		}
+		REQUIRE(sink.Finish());
+		// Raw frames take 36 bytes per body
+		REQUIRE(sink.GetBytesWritten() < 4 * 10000 * 36 / 3);
+	}
+
+	CompressedTrajectoryReader reader;
+	REQUIRE(reader.Open("trajectory_test.nbtz"));
+	for (const TrajectoryFrame &expected : frames) {
+		TrajectoryFrame decoded;
+		REQUIRE(reader.ReadFrame(decoded));
+		REQUIRE(decoded.step == expected.step);
+		REQUIRE(decoded.ids == expected.ids);
+		REQUIRE(decoded.masses == expected.masses);
+
+		float position_error = 0;
+		float velocity_error = 0;
+		for (size_t i = 0; i < expected.positions.size(); i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				position_error = std::max(position_error, std::abs(decoded.positions[i][axis] - expected.positions[i][axis]));
+				velocity_error = std::max(velocity_error, std::abs(decoded.velocities[i][axis] - expected.velocities[i][axis]));
+			}
+		}
+		REQUIRE(position_error <= 0.0101f);
+		REQUIRE(velocity_error <= 0.00101f);
+	}
+
+	TrajectoryFrame past_end;
+	REQUIRE_FALSE(reader.ReadFrame(past_end));
+
+	// Damaged sizes are rejected instead of allocated. The first frame starts after the
+	// 28 byte header, with its count at byte 44, block count at 56 and block sizes at 60
+	std::ifstream in("trajectory_test.nbtz", std::ios::binary);
+	string original((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+
+	string bad_count = original;
+	uint64_t count = 4096ull * 1000000;
+	uint32_t block_count = 1000000;
+	std::memcpy(&bad_count[44], &count, sizeof(count));
+	std::memcpy(&bad_count[56], &block_count, sizeof(block_count));
+	std::ofstream("trajectory_test.nbtz", std::ios::binary) << bad_count;
+	REQUIRE(reader.Open("trajectory_test.nbtz"));
+	REQUIRE_FALSE(reader.ReadFrame(past_end));
+
+	string bad_block = original;
+	uint64_t block_bytes = ~0ull;
+	std::memcpy(&bad_block[60], &block_bytes, sizeof(block_bytes));
+	std::ofstream("trajectory_test.nbtz", std::ios::binary) << bad_block;
+	REQUIRE(reader.Open("trajectory_test.nbtz"));
+	REQUIRE_FALSE(reader.ReadFrame(past_end));
+	std::remove("trajectory_test.nbtz");
+}
+
+TEST_CASE("Indexed trajectories seek to any frame", "[trajectory]") {
+	TrajectoryFrame frame;
+	frame.positions = { ofVec3f(0, 0, 0), ofVec3f(1, 2, 3), ofVec3f(4, 5, 6) };
+	frame.velocities = { ofVec3f(1, 0, 0), ofVec3f(0, 1, 0), ofVec3f(0, 0, 1) };
+	frame.masses = { 1, 2, 3 };
+	frame.ids = { 7, 8, 9 };
+
+	for (int finish = 0; finish < 2; finish++) {
+		{
+			IndexedFrameSink sink("trajectory_test.nbti");
+			for (int f = 0; f < 10; f++) {
+				frame.step = f * 5;
+				frame.time = f * 0.1;
+				frame.positions[0].x = (float)f;
+				REQUIRE(sink.WriteFrame(frame));
+			}
+
+			// An unfinished file has no index, which the reader rebuilds
+			if (finish) {
+				REQUIRE(sink.Finish());
+			}
+		}
+
+		IndexedTrajectoryReader reader;
+		REQUIRE(reader.Open("trajectory_test.nbti"));
+		REQUIRE(reader.CountFrames() == 10);
+		REQUIRE(reader.FindFrame(0.35) == 3);
+		REQUIRE(reader.FindFrame(3 * 0.1) == 3);
+		REQUIRE(reader.FindFrame(-1) == 0);
+		REQUIRE(reader.FindFrame(5) == 9);
+		REQUIRE(reader.GetEntry(7).step == 35);
+		REQUIRE(reader.GetPositions(7)[0].x == 7);
+		REQUIRE(reader.GetMasses(7).Slice(1, 5).size() == 2);
+		REQUIRE(reader.GetIds(4).Slice(1, 1)[0] == 8);
+
+		TrajectoryFrame read;
+		REQUIRE(reader.ReadFrame(9, read));
+		REQUIRE(read.velocities == frame.velocities);
+		REQUIRE_FALSE(reader.ReadFrame(10, read));
+		reader.Close();
+	}
+
+	std::remove("trajectory_test.nbti");
+}
+
+TEST_CASE("Generated initial conditions do not depend on the thread count", "[generate]") {
+	for (int model = 0; model < MODEL_TYPE_COUNT; model++) {
+		InitialConditionSettings settings;
+		settings.model = (ModelType)model;
+		settings.count = 20000;
+		settings.concentration = (settings.model == KING) ? 6 : 10;
+
+		SetWorkerThreads(1);
+		InitialConditions serial;
+		REQUIRE(serial.Generate(settings));
+
+		SetWorkerThreads(4);
+		InitialConditions parallel;
+		REQUIRE(parallel.Generate(settings));
+		SetWorkerThreads(0);
+
+		REQUIRE(parallel.GetPositions().size() == 20000);
+		REQUIRE(std::equal(serial.GetPositions().begin(), serial.GetPositions().end(),
+						   parallel.GetPositions().begin()));
+		REQUIRE(std::equal(serial.GetVelocities().begin(), serial.GetVelocities().end(),
+						   parallel.GetVelocities().begin()));
+
+		FewBodyEngine fbe;
+		parallel.AddTo(fbe);
+		REQUIRE(fbe.CountBodies() == 20000);
+		REQUIRE(fbe.GetMasses()[0] == Approx(settings.total_mass / 20000));
+	}
+
+	InitialConditionSettings settings;
+	settings.seed = 2;
+	InitialConditions first;
+	InitialConditions second;
+	REQUIRE(first.Generate(settings));
+	settings.seed = 3;
+	REQUIRE(second.Generate(settings));
+	REQUIRE(first.GetPositions()[0] != second.GetPositions()[0]);
+
+	// King models too shallow to tabulate are rejected, the shallowest accepted one works
+	settings.model = KING;
+	settings.concentration = 1e-7;
+	REQUIRE_FALSE(first.Generate(settings));
+	settings.concentration = 0.1;
+	REQUIRE(first.Generate(settings));
+	REQUIRE(first.GetPositions().size() == (size_t)settings.count);
+}
+
+TEST_CASE("CSV tables load with mapped columns", "[csv]") {
+	{
+		std::ofstream file("csv_test.csv", std::ios::binary);
+		file << "# exported stars\n"
+			 << "id,px,py,pz,m,vx\n"
+			 << "0,1.5,-2,3e2,4,0.25\r\n"
+			 << "\n"
+			 << "1, 5 ,6,7,8,-1\n"
+			 << "# a comment between bodies\n"
+			 << "2,9,10,11,12,0";
+	}
+
+	CsvImporter importer;
+	REQUIRE_FALSE(importer.MapColumns("speed=3"));
+	REQUIRE(importer.MapColumns("x=px,y=py,z=pz,mass=4"));
+
+	FewBodyEngine fbe(1, false);
+	REQUIRE(importer.Load("csv_test.csv", fbe));
+	REQUIRE(fbe.CountBodies() == 3);
+	REQUIRE(fbe.GetBodyPositions()[0] == ofVec3f(1.5f, -2, 300));
+	REQUIRE(fbe.GetBodyPositions()[1] == ofVec3f(5, 6, 7));
+	REQUIRE(fbe.GetBodyPositions()[2] == ofVec3f(9, 10, 11));
+	REQUIRE(fbe.GetMasses()[2] == 12);
+	REQUIRE(fbe.GetVelocities()[0] == ofVec3f(0.25f, 0, 0));
+	REQUIRE(fbe.GetVelocities()[1] == ofVec3f(-1, 0, 0));
+	REQUIRE(fbe.GetColors()[0] == ofColor(255, 255, 255));
+
+	// Enough lines for several chunks, with one bad line near the end
+	{
+		std::ofstream file("csv_test.csv", std::ios::binary);
+		for (int i = 0; i < 50000; i++) {
+			file << i << " " << -i << " " << 2 * i << " 0 0 0 1\n";
+		}
+		file << "1 2 x 0 0 0 1\n";
+	}
+
+	SetWorkerThreads(4);
+	CsvImporter bulk;
+	FewBodyEngine bad(1, false);
+	REQUIRE_FALSE(bulk.Load("csv_test.csv", bad));
+	REQUIRE(bulk.GetBadLine() == 50001);
+	REQUIRE(bad.CountBodies() == 0);
+
+	{
+		std::ofstream file("csv_test.csv", std::ios::binary);
+		for (int i = 0; i < 50000; i++) {
+			file << i << " " << -i << " " << 2 * i << " 0 0 0 1\n";
+		}
+	}
+
+	FewBodyEngine good(1, false);
+	REQUIRE(bulk.Load("csv_test.csv", good));
+	REQUIRE(good.CountBodies() == 50000);
+	REQUIRE(good.GetBodyPositions()[12345] == ofVec3f(12345, -12345, 24690));
+	REQUIRE(good.GetBodyPositions()[49999] == ofVec3f(49999, -49999, 99998));
+	SetWorkerThreads(0);
+	std::remove("csv_test.csv");
+}
+
+TEST_CASE("Replays play recorded frames in both directions", "[replay]") {
+	FewBodyEngine fbe(1, false);
+	fbe.AddBody(-100, 0, 0, 0, 1, 0, 1, ofColor(255, 0, 0));
+	fbe.AddBody(100, 0, 0, 0, -1, 0, 1, ofColor(0, 255, 0));
+
+	IndexedFrameSink sink("replay_test.nbti");
+	TrajectoryWriter writer(&sink, 1);
+	vector<ofVec3f> recorded;
+	for (uint64_t step = 0; step < 20; step++) {
+		writer.Capture(fbe, step);
+		recorded.push_back(fbe.GetPositions()[0]);
+		fbe.update();
+	}
+	writer.Finish();
+
+	TrajectoryPlayer player;
+	REQUIRE(player.Open("replay_test.nbti", fbe.GetIds(), fbe.GetColors()));
+	REQUIRE(player.CountFrames() == 20);
+
+	const BodySnapshot *before;
+	const BodySnapshot *after;
+	player.Seek(7.25);
+	REQUIRE(player.AcquireSnapshots(before, after) == Approx(0.25));
+	REQUIRE(before->positions[0] == recorded[7]);
+	REQUIRE(after->positions[0] == recorded[8]);
+	REQUIRE(before->colors[1] == ofColor(0, 255, 0));
+	REQUIRE(before->radii[0] == PhysicsEngine::CalculateRadius(1));
+
+	// Backwards at 10 frames per second, stopping at the first frame
+	player.SetSpeed(-10);
+	player.SetPlaying(true);
+	player.Update(0.5);
+	REQUIRE(player.GetPosition() == Approx(2.25));
+	player.AcquireSnapshots(before, after);
+	REQUIRE(before->positions[0] == recorded[2]);
+	player.Update(1);
+	REQUIRE(player.GetPosition() == 0);
+	REQUIRE_FALSE(player.IsPlaying());
+
+	// A jump far ahead is read straight away
+	player.Seek(100);
+	player.AcquireSnapshots(before, after);
+	REQUIRE(before->positions[0] == recorded[19]);
+	REQUIRE(before == after);
+
+	player.Close();
+	std::remove("replay_test.nbti");
+}
+
+TEST_CASE("Selectors pick ids, regions and mass ranges", "[select]") {
+	FewBodyEngine fbe(1, false);
+	for (int i = 0; i < 50000; i++) {
+		fbe.AddBody(ofVec3f((float)(i % 100), (float)(i / 100), 0), ofVec3f(0, 0, 0), 1 + i % 3, ofColor(255, 255, 255));
+	}
+
+	OutputSelector selector;
+	vector<uint32_t> selected;
+	selector.Select(fbe.GetPositions(), fbe.GetMasses(), fbe.GetIds(), selected);
+	REQUIRE(selector.IsEmpty());
+	REQUIRE(selected.size() == 50000);
+
+	// Ids 7 and 49999, the 3x3 box at the origin and the sphere around (50, 50, 0)
+	selector.AddIds({ 49999, 7 });
+	selector.AddBox(ofVec3f(2, 2, 1), ofVec3f(0, 0, -1));
+	selector.AddSphere(ofVec3f(50, 50, 0), 1);
+	SetWorkerThreads(4);
+	selector.Select(fbe.GetPositions(), fbe.GetMasses(), fbe.GetIds(), selected);
+	REQUIRE(selected == vector<uint32_t>({ 0, 1, 2, 7, 100, 101, 102, 200, 201, 202,
+										   4950, 5049, 5050, 5051, 5150, 49999 }));
+
+	selector.SetMassRange(2, 2);
+	SetWorkerThreads(1);
+	selector.Select(fbe.GetPositions(), fbe.GetMasses(), fbe.GetIds(), selected);
+	SetWorkerThreads(0);
+	REQUIRE(selected == vector<uint32_t>({ 1, 7, 100, 202, 5050, 49999 }));
+
+	MemoryFrameSink sink;
+	TrajectoryWriter writer(&sink, 1);
+	writer.SetSelector(&selector);
+	writer.Capture(fbe, 0);
+	writer.Finish();
+	REQUIRE(sink.frames.size() == 1);
+	REQUIRE(sink.frames[0].ids == vector<uint32_t>({ 1, 7, 100, 202, 5050, 49999 }));
+	REQUIRE(sink.frames[0].positions[2] == ofVec3f(0, 1, 0));
+	REQUIRE(sink.frames[0].masses[0] == 2);
+}